@@ -0,0 +1,15 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+// Wall time of one call to f, in milliseconds
+template <class F> double time_ms(F&& f) {
+	auto start = std::chrono::steady_clock::now();
+	f();
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void bvh_benchmark(size_t count);
+void ecs_benchmark(size_t count);
+void jobs_benchmark();
@@ -0,0 +1,39 @@
+#include "bench.hpp"
+#include "render/bvh.hpp"
+#include <iostream>
+#include <random>
+
+// Times building a surface BVH against keeping it up to date as every surface moves
+void bvh_benchmark(size_t count) {
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> position(-1000, 1000), size(0.5f, 5), step(-1, 1);
+	std::vector<glm::vec3> mins(count), sizes(count);
+	for (size_t i = 0; i < count; i++) {
+		mins[i] = {position(rng), position(rng), position(rng)};
+		sizes[i] = {size(rng), size(rng), size(rng)};
+	}
+
+	Render::SurfaceBVH tree;
+	double insert = time_ms([&] {
+		for (size_t i = 0; i < count; i++)
+			tree.insert(i, mins[i], mins[i] + sizes[i]);
+	});
+	double insertCost = tree.cost();
+	double build = time_ms([&] { tree.rebuild(); });
+	double buildCost = tree.cost();
+
+	for (auto& min : mins)
+		min += glm::vec3(step(rng), step(rng), step(rng));
+	double refit = time_ms([&] {
+		for (size_t i = 0; i < count; i++)
+			tree.update(i, mins[i], mins[i] + sizes[i]);
+	});
+	double refitCost = tree.cost();
+	double rebuild = time_ms([&] { tree.rebuild(); });
+
+	std::cout << count << " surfaces\n"
+			  << "Insert one by one: " << insert << " ms, cost " << insertCost << "\n"
+			  << "SAH build: " << build << " ms, cost " << buildCost << "\n"
+			  << "Refit after every surface moved: " << refit << " ms, cost " << refitCost << "\n"
+			  << "Rebuild after every surface moved: " << rebuild << " ms, cost " << tree.cost() << std::endl;
+}
@@ -0,0 +1,95 @@
+#include "bench.hpp"
+#include "entities/registry.hpp"
+#include <cmath>
+#include <glm/glm.hpp>
+#include <iostream>
+
+// One component type per system in the scheduling benchmark, so none of the systems conflict
+template <int N> struct BenchmarkAngle {
+	float value;
+};
+template <int N> static void add_benchmark_spin(Registry& registry) {
+	registry.add_system(
+		"Spin", Registry::Access().write<BenchmarkAngle<N>>(), [](Registry& registry, double dTime) {
+			registry.each<BenchmarkAngle<N>>([&](Entity, BenchmarkAngle<N>& angle) {
+				for (int i = 0; i < 16; i++)
+					angle.value = std::sin(angle.value + static_cast<float>(dTime));
+			});
+		});
+}
+
+// Times a system moving count entities over some frames, against the same update as a virtual call on each of count
+// heap allocated objects. Then times four independent systems on one thread against all of them
+void ecs_benchmark(size_t count) {
+	const int frames = 100;
+	struct Position {
+		glm::vec3 value;
+	};
+	struct Velocity {
+		glm::vec3 value;
+	};
+	JobSystem serialJobs(0);
+	Registry registry(serialJobs);
+	for (size_t i = 0; i < count; i++) {
+		Entity entity = registry.create();
+		registry.emplace<Position>(entity, glm::vec3(i));
+		registry.emplace<Velocity>(entity, glm::vec3(1, 0, 0));
+	}
+	registry.add_system(
+		"Move", Registry::Access().read<Velocity>().write<Position>(), [](Registry& registry, double dTime) {
+			registry.each<Position, Velocity>([&](Entity, Position& position, Velocity& velocity) {
+				position.value += velocity.value * static_cast<float>(dTime);
+			});
+		});
+	double ecs = time_ms([&] {
+		for (int frame = 0; frame < frames; frame++)
+			registry.update(1.0 / 60);
+	});
+
+	struct Mover {
+		virtual ~Mover() {}
+		virtual void update(double dTime) = 0;
+	};
+	struct Moving : Mover {
+		glm::vec3 position, velocity;
+		Moving(glm::vec3 position) : position(position), velocity(1, 0, 0) {}
+		void update(double dTime) override { position += velocity * static_cast<float>(dTime); }
+	};
+	std::vector<std::unique_ptr<Mover>> movers;
+	for (size_t i = 0; i < count; i++)
+		movers.push_back(std::make_unique<Moving>(glm::vec3(i)));
+	double virtualCalls = time_ms([&] {
+		for (int frame = 0; frame < frames; frame++)
+			for (auto& mover : movers)
+				mover->update(1.0 / 60);
+	});
+
+	auto spin_frame_ms = [&](JobSystem& jobs) {
+		Registry registry(jobs);
+		for (size_t i = 0; i < count; i++) {
+			Entity entity = registry.create();
+			registry.emplace<BenchmarkAngle<0>>(entity, 0.0f);
+			registry.emplace<BenchmarkAngle<1>>(entity, 0.0f);
+			registry.emplace<BenchmarkAngle<2>>(entity, 0.0f);
+			registry.emplace<BenchmarkAngle<3>>(entity, 0.0f);
+		}
+		add_benchmark_spin<0>(registry);
+		add_benchmark_spin<1>(registry);
+		add_benchmark_spin<2>(registry);
+		add_benchmark_spin<3>(registry);
+		const int spinFrames = frames / 10;
+		double ms = time_ms([&] {
+			for (int frame = 0; frame < spinFrames; frame++)
+				registry.update(1.0 / 60);
+		});
+		return ms / spinFrames;
+	};
+	JobSystem parallelJobs;
+	double serialSpin = spin_frame_ms(serialJobs), parallelSpin = spin_frame_ms(parallelJobs);
+
+	std::cout << count << " entities, " << frames << " frames\n"
+			  << "Sparse set system: " << count * frames * 1000 / ecs << " entity updates per second\n"
+			  << "Virtual update per object: " << count * frames * 1000 / virtualCalls << " entity updates per second\n"
+			  << "Four independent systems: " << serialSpin << " ms per frame on one thread, " << parallelSpin
+			  << " ms on " << parallelJobs.worker_count() + 1 << std::endl;
+}
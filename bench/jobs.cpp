@@ -0,0 +1,51 @@
+#include "bench.hpp"
+#include "job_system.hpp"
+#include <atomic>
+#include <cmath>
+#include <iostream>
+
+// Times the job system's scheduling overhead: empty jobs run one by one, with and without a trace hook, a chain of
+// jobs each waiting on the last, and a cheap loop split at several grains
+void jobs_benchmark() {
+	JobSystem jobs;
+	std::cout << jobs.worker_count() << " workers\n";
+
+	const size_t count = 1000000;
+	auto run_empty = [&] {
+		JobSystem::Counter counter;
+		for (size_t i = 0; i < count; i++)
+			jobs.run([] {}, &counter);
+		jobs.wait(counter);
+	};
+	double empty = time_ms(run_empty);
+	std::cout << "Empty jobs: " << empty * 1e6 / count << " ns each\n";
+
+	std::atomic<size_t> traced = 0;
+	jobs.set_trace_hook([&](const JobSystem::Trace&) { traced.fetch_add(1, std::memory_order_relaxed); });
+	double tracedEmpty = time_ms(run_empty);
+	jobs.set_trace_hook(nullptr);
+	std::cout << "Empty jobs, traced: " << tracedEmpty * 1e6 / count << " ns each, " << traced << " traces\n";
+
+	const size_t chainLength = 100000;
+	double chain = time_ms([&] {
+		std::vector<JobSystem::Counter> links(chainLength);
+		jobs.run([] {}, &links[0]);
+		for (size_t i = 1; i < chainLength; i++)
+			jobs.run_after(links[i - 1], [] {}, &links[i]);
+		jobs.wait(links.back());
+	});
+	std::cout << "Chain of dependent jobs: " << chain * 1e6 / chainLength << " ns each\n";
+
+	std::vector<float> values(1 << 24, 2.0f);
+	auto work = [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			values[i] = std::sqrt(values[i] + 1.0f);
+	};
+	double serial = time_ms([&] { work(0, values.size()); });
+	std::cout << "Serial loop over " << values.size() << " floats: " << serial << " ms\n";
+	for (size_t grain : {256, 4096, 65536}) {
+		double parallel = time_ms([&] { jobs.parallel_for(values.size(), grain, work); });
+		std::cout << "parallel_for, grain " << grain << ": " << parallel << " ms, " << serial / parallel << "x\n";
+	}
+	std::cout << std::flush;
+}
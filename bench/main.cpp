@@ -0,0 +1,31 @@
+#include "bench.hpp"
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Runs the benchmarks named on the command line, or all of them without any. None of them open a window
+int main(int argc, char* argv[]) {
+	const std::vector<std::pair<std::string, std::function<void()>>> benchmarks = {
+		// The surface BVH with 100k surfaces
+		{"bvh", [] { bvh_benchmark(100000); }},
+		// Entity updates with 100k entities
+		{"ecs", [] { ecs_benchmark(100000); }},
+		// Job scheduling overhead
+		{"jobs", jobs_benchmark},
+	};
+
+	std::vector<std::string> args(argv + 1, argv + argc);
+	for (auto& arg : args) {
+		auto named = [&](auto& benchmark) { return benchmark.first == arg; };
+		if (std::none_of(benchmarks.begin(), benchmarks.end(), named)) {
+			std::cerr << "Unknown benchmark " << arg << std::endl;
+			return 1;
+		}
+	}
+	for (auto& [name, run] : benchmarks)
+		if (args.empty() || std::find(args.begin(), args.end(), name) != args.end())
+			run();
+}
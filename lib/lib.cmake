@@ -17,6 +17,9 @@ endif()
 target_compile_definitions(libs INTERFACE GLFW_INCLUDE_NONE)
 target_link_libraries(libs INTERFACE glfw)
 
+find_package(Threads REQUIRED)
+target_link_libraries(libs INTERFACE Threads::Threads)
+
 include(${CMAKE_CURRENT_LIST_DIR}/gl/gl.cmake)
 target_link_libraries(libs INTERFACE gl)
 
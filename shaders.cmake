@@ -2,7 +2,11 @@ find_program(GLSLC NAMES glslc REQUIRED)
 
 set(BINARY_DIR ${CMAKE_CURRENT_BINARY_DIR}/shaders/)
 
-file(GLOB_RECURSE SHADERS CONFIGURE_DEPENDS ${CMAKE_CURRENT_LIST_DIR}/shaders/*.vert ${CMAKE_CURRENT_LIST_DIR}/shaders/*.frag)
+file(GLOB_RECURSE SHADERS CONFIGURE_DEPENDS
+	${CMAKE_CURRENT_LIST_DIR}/shaders/*.vert
+	${CMAKE_CURRENT_LIST_DIR}/shaders/*.geom
+	${CMAKE_CURRENT_LIST_DIR}/shaders/*.frag
+	${CMAKE_CURRENT_LIST_DIR}/shaders/*.comp)
 
 set(shaders_hpp ${BINARY_DIR}/include/shaders.hpp)
 file(WRITE ${shaders_hpp} "#pragma once\n#include <vector>\n#include <cstdint>\nnamespace Render::Shaders {\n")
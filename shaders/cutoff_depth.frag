@@ -2,28 +2,29 @@
 
 layout(location = 4) in sample vec2 uv;
 
-layout(std140, binding = 1) uniform Material {
+layout(constant_id = 0) const bool has_albedo_texture = false;
+
+struct Material {
 	vec4 albedoFactor;
 	vec3 emissiveFactor;
 	float metalFactor;
 	float roughFactor;
 	float reflectionLevels;
-	bool has_albedo_texture;
-	bool has_metal_rough_texture;
-	bool has_normal_texture;
-	bool has_occlusion_texture;
-	bool has_emissive_texture;
 	float alpha_depth_cutoff;
+	vec4 _pad; // Material blocks are 64 bytes apart
 };
-layout(binding = 3) uniform sampler2D albedoTex;
+layout(std430, binding = 3) readonly buffer Materials { Material materials[]; };
+layout(location = 5) flat in uint materialIndex;
+Material material = materials[materialIndex];
+layout(binding = 6) uniform sampler2D albedoTex;
 
 void main() {
 	float alpha;
 	if (has_albedo_texture)
-		alpha = albedoFactor.a * texture(albedoTex, uv).a;
+		alpha = material.albedoFactor.a * texture(albedoTex, uv).a;
 	else
-		alpha = albedoFactor.a;
+		alpha = material.albedoFactor.a;
 
-	if (alpha < alpha_depth_cutoff)
+	if (alpha < material.alpha_depth_cutoff)
 		discard;
 }
\ No newline at end of file
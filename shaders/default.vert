@@ -6,28 +6,34 @@ layout(location = 2) in vec3 tangent;
 layout(location = 3) in vec3 bitangent;
 layout(location = 4) in vec2 uv;
 
-layout(location = 0) uniform mat4 model;
-
 layout(std140, binding = 0) uniform Camera {
 	mat4 proj;
 	mat4 view;
 	vec3 camPos;
 };
 
-vec4 worldPos = model * vec4(pos, 1);
+struct Surface {
+	mat4 model;
+	mat3 normalMatrix;
+	uint material;
+};
+layout(std430, binding = 2) readonly buffer Surfaces { Surface surfaces[]; };
 
 layout(location = 0) out vec3 outWorldPos;
 layout(location = 1) out vec3 outNormal;
 layout(location = 2) out vec3 outTangent;
 layout(location = 3) out vec3 outBitangent;
 layout(location = 4) out vec2 outuv;
+layout(location = 5) flat out uint outMaterial;
 
 void main() {
+	Surface surface = surfaces[gl_BaseInstance];
+	vec4 worldPos = surface.model * vec4(pos, 1);
 	gl_Position = proj * view * worldPos;
 	outWorldPos = vec3(worldPos);
-	mat3 normalMatrix = mat3(transpose(inverse(model)));
-	outNormal = normalMatrix * normal;
-	outTangent = normalMatrix * tangent;
-	outBitangent = normalMatrix * bitangent;
+	outNormal = surface.normalMatrix * normal;
+	outTangent = surface.normalMatrix * tangent;
+	outBitangent = surface.normalMatrix * bitangent;
 	outuv = uv;
+	outMaterial = surface.material;
 }
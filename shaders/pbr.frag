@@ -1,6 +1,6 @@
 #version 460 core
 
-layout(binding = 0) uniform sampler2DArrayShadow dirLightShadowMaps;
+layout(binding = 0) uniform sampler2DShadow dirLightShadowAtlas;
 
 layout(std140, binding = 0) uniform Camera {
 	mat4 proj;
@@ -8,16 +8,42 @@ layout(std140, binding = 0) uniform Camera {
 	vec3 camPos;
 };
 
+const uint shadowCascades = 4;
 struct DirLight {
 	vec3 dir;
 	vec3 colour;
-	mat4 shadowMapTrans;
+	mat4 shadowMapTrans[shadowCascades]; // Into the light's tiles of the atlas
+	vec4 shadowTiles[shadowCascades];
 };
-layout(std430, binding = 1) readonly buffer DirLights { DirLight dirLights[]; };
+layout(std430, binding = 1) readonly buffer DirLights {
+	uint dirLightCount;
+	DirLight dirLights[];
+};
+
+struct LocalLight {
+	vec3 pos;
+	float range;
+	vec3 colour;
+	float spotScale; // Point lights have no cone, spotScale = 0 and spotOffset = 1
+	vec3 dir;
+	float spotOffset;
+};
+layout(std430, binding = 6) readonly buffer LocalLights {
+	vec2 clusterTileScale;
+	float clusterSliceScale;
+	float clusterSliceBias;
+	uint localLightCount;
+	LocalLight localLights[];
+};
+// Filled by light_cluster.comp
+const uvec3 clusterGrid = uvec3(16, 9, 24);
+const uint maxClusterLights = 256;
+layout(std430, binding = 7) readonly buffer ClusterCounts { uint clusterLightCounts[]; };
+layout(std430, binding = 8) readonly buffer ClusterIndices { uint clusterLightIndices[]; };
 
-layout(binding = 3) uniform samplerCube irradiance;
-layout(binding = 4) uniform samplerCube reflection;
-layout(binding = 5) uniform sampler2D reflectionBRDF;
+layout(std430, binding = 4) readonly buffer Irradiance { vec4 irradianceSH[9]; };
+layout(binding = 3) uniform samplerCube reflection;
+layout(binding = 4) uniform sampler2D reflectionBRDF;
 
 layout(location = 0) in vec3 pos;
 layout(location = 1) in vec3 norm;
@@ -25,19 +51,24 @@ layout(location = 2) in vec3 tang;
 layout(location = 3) in vec3 bitang;
 layout(location = 4) in vec2 uv;
 
-layout(std140, binding = 1) uniform Material {
+layout(constant_id = 0) const bool has_albedo_texture = false;
+layout(constant_id = 1) const bool has_metal_rough_texture = false;
+layout(constant_id = 2) const bool has_normal_texture = false;
+layout(constant_id = 3) const bool has_occlusion_texture = false;
+layout(constant_id = 4) const bool has_emissive_texture = false;
+
+struct Material {
 	vec4 albedoFactor;
 	vec3 emissiveFactor;
 	float metalFactor;
 	float roughFactor;
 	float reflectionLevels;
-	bool has_albedo_texture;
-	bool has_metal_rough_texture;
-	bool has_normal_texture;
-	bool has_occlusion_texture;
-	bool has_emissive_texture;
 	float alpha_depth_cutoff;
+	vec4 _pad; // Material blocks are 64 bytes apart
 };
+layout(std430, binding = 3) readonly buffer Materials { Material materials[]; };
+layout(location = 5) flat in uint materialIndex;
+Material material = materials[materialIndex];
 layout(binding = 6) uniform sampler2D albedoTex;
 layout(binding = 7) uniform sampler2D metalRoughTex;
 layout(binding = 8) uniform sampler2D normalTexture;
@@ -55,20 +86,20 @@ vec3 emissive;
 void setup_fragment_props() {
 	vec4 _albedo;
 	if (has_albedo_texture) {
-		_albedo = albedoFactor * texture(albedoTex, uv);
+		_albedo = material.albedoFactor * texture(albedoTex, uv);
 	} else {
-		_albedo = albedoFactor;
+		_albedo = material.albedoFactor;
 	}
 	albedo = _albedo.rgb;
 	alpha = _albedo.a;
 
 	if (has_metal_rough_texture) {
 		vec4 metalRough = texture(metalRoughTex, uv);
-		metallic = metalFactor * metalRough.b;
-		roughness = roughFactor * metalRough.g;
+		metallic = material.metalFactor * metalRough.b;
+		roughness = material.roughFactor * metalRough.g;
 	} else {
-		metallic = metalFactor;
-		roughness = roughFactor;
+		metallic = material.metalFactor;
+		roughness = material.roughFactor;
 	}
 
 	if (has_normal_texture) {
@@ -87,9 +118,9 @@ void setup_fragment_props() {
 	}
 
 	if (has_emissive_texture) {
-		emissive = emissiveFactor * texture(emissiveTexture, uv).rgb;
+		emissive = material.emissiveFactor * texture(emissiveTexture, uv).rgb;
 	} else {
-		emissive = emissiveFactor;
+		emissive = material.emissiveFactor;
 	}
 }
 
@@ -135,17 +166,56 @@ vec3 pbr_brdf(vec3 wi) {
 
 vec3 light(vec3 dir, vec3 colour) { return pbr_brdf(dir) * colour * max(dot(dir, normal), 0.0); }
 
+vec3 irradiance(vec3 n) { // L2 spherical harmonics, convolved by sh_reduce.comp
+	return irradianceSH[0].rgb * 0.282095 +
+		(irradianceSH[1].rgb * n.y + irradianceSH[2].rgb * n.z + irradianceSH[3].rgb * n.x) * 0.488603 +
+		(irradianceSH[4].rgb * n.x * n.y + irradianceSH[5].rgb * n.y * n.z + irradianceSH[7].rgb * n.x * n.z) *
+			1.092548 +
+		irradianceSH[6].rgb * 0.315392 * (3 * n.z * n.z - 1) + irradianceSH[8].rgb * 0.546274 * (n.x * n.x - n.y * n.y);
+}
+
 vec3 enviroment() {
 	// Code from: https://learnopengl.com/PBR/IBL/Specular-IBL
 	vec3 f0 = mix(vec3(0.04), albedo, metallic);
 	vec3 F = f0 + (max(vec3(1.0 - roughness), f0) - f0) * pow(1 - abs(dot(wo, normal)), 5);
-	vec3 diffuse = texture(irradiance, normal).rgb * (1 - F) * albedo * (1 - 0.04) * (1 - metallic);
+	vec3 diffuse = max(irradiance(normal), 0.0) * (1 - F) * albedo * (1 - 0.04) * (1 - metallic);
 	vec2 envBRDF = texture(reflectionBRDF, vec2(max(dot(normal, wo), 0.0), roughness)).rg;
-	vec3 specular =
-		textureLod(reflection, reflect(-wo, normal), roughness * reflectionLevels).rgb * (F * envBRDF.r + envBRDF.g);
+	vec3 specular = textureLod(reflection, reflect(-wo, normal), roughness * material.reflectionLevels).rgb *
+		(F * envBRDF.r + envBRDF.g);
 	return diffuse + specular;
 }
 
+float dir_light_shadow(uint light) {
+	// Cascades are ordered near to far, use the first, and so sharpest, that covers the fragment
+	for (uint c = 0; c < shadowCascades; c++) {
+		vec4 shadowSample = dirLights[light].shadowMapTrans[c] * vec4(pos, 1);
+		vec3 projCoords = shadowSample.xyz / shadowSample.w;
+		// Cascades that didn't fit in the atlas have an empty tile
+		vec4 tile = dirLights[light].shadowTiles[c];
+		if (all(greaterThan(projCoords.xy, tile.xy)) && all(lessThan(projCoords.xy, tile.zw)))
+			return texture(dirLightShadowAtlas, projCoords);
+	}
+	return 1.0;
+}
+
+vec3 local_light(LocalLight l) {
+	vec3 toLight = l.pos - pos;
+	float dist2 = dot(toLight, toLight);
+	vec3 dir = toLight * inversesqrt(dist2);
+	// Inverse square, windowed to reach zero at range
+	float window = clamp(1 - pow(dist2 / (l.range * l.range), 2), 0.0, 1.0);
+	float falloff = window * window / max(dist2, 1e-4);
+	float cone = clamp(dot(-dir, l.dir) * l.spotScale + l.spotOffset, 0.0, 1.0);
+	return light(dir, l.colour * falloff * cone * cone);
+}
+
+uint cluster_index() {
+	uvec2 tile = min(uvec2(gl_FragCoord.xy * clusterTileScale), clusterGrid.xy - 1);
+	float depth = -(view * vec4(pos, 1)).z;
+	uint slice = uint(clamp(log(depth) * clusterSliceScale - clusterSliceBias, 0.0, clusterGrid.z - 1.0));
+	return (slice * clusterGrid.y + tile.y) * clusterGrid.x + tile.x;
+}
+
 void main() {
 	setup_fragment_props();
 
@@ -153,12 +223,11 @@ void main() {
 
 	colour += enviroment() * occlusion;
 
-	for (int i = 0; i < dirLights.length(); ++i) {
-		vec4 shadowSample = (dirLights[i].shadowMapTrans * vec4(pos, 1));
-		vec3 projCoords = shadowSample.xyz / shadowSample.w;
-		projCoords = projCoords * 0.5 + 0.5;
-		float shadowDepth = texture(dirLightShadowMaps, vec4(projCoords.xy, i, projCoords.z));
-		colour += light(dirLights[i].dir, dirLights[i].colour * shadowDepth);
-	}
+	for (uint i = 0; i < dirLightCount; ++i)
+		colour += light(dirLights[i].dir, dirLights[i].colour * dir_light_shadow(i));
+
+	uint cluster = cluster_index();
+	for (uint i = 0; i < clusterLightCounts[cluster]; ++i)
+		colour += local_light(localLights[clusterLightIndices[cluster * maxClusterLights + i]]);
 	outColour = vec4(colour, alpha);
 }
@@ -2,7 +2,7 @@
 
 layout(location = 0) in vec3 TexCoords;
 
-layout(binding = 3) uniform sampler2D rectSkybox;
+layout(binding = 6) uniform sampler2D rectSkybox;
 
 layout(location = 0) out vec4 outColour;
 
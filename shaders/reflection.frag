@@ -1,12 +1,16 @@
 #version 460 core
 
 // Code from: https://learnopengl.com/PBR/IBL/Specular-IBL
+// Filtered importance sampling from: GPU Gems 3, chapter 20, "GPU-Based Importance Sampling"
 
 layout(location = 0) in vec3 TexCoords;
 
 layout(binding = 1) uniform samplerCube environmentMap;
 
 layout(location = 1) uniform float roughness;
+layout(location = 2) uniform float environmentSize;
+layout(location = 3) uniform uint sampleCount;
+layout(location = 4) uniform float levelSize;
 
 layout(location = 0) out vec4 outColour;
 
@@ -39,26 +43,40 @@ vec3 ImportanceSampleGGX(vec2 Xi, vec3 N, float roughness) {
 	vec3 sampleVec = tangent * H.x + bitangent * H.y + N * H.z;
 	return normalize(sampleVec);
 }
+float D_GGX(float NdotH, float roughness) {
+	float a2 = pow(roughness, 4);
+	float d = NdotH * NdotH * (a2 - 1.0) + 1.0;
+	return a2 / (pi * d * d);
+}
 void main() {
 	vec3 N = normalize(TexCoords);
 	vec3 R = N;
 	vec3 V = R;
 
-	const uint SAMPLE_COUNT = 1024u;
+	// Solid angle of one texel at the top of the environment mip chain
+	float saTexel = 4.0 * pi / (6.0 * environmentSize * environmentSize);
+	// Never read from mips finer than the level being written
+	float minLod = log2(environmentSize / levelSize);
+
 	float totalWeight = 0.0;
 	vec3 prefilteredColor = vec3(0.0);
-	for (uint i = 0u; i < SAMPLE_COUNT; ++i) {
-		vec2 Xi = Hammersley(i, SAMPLE_COUNT);
+	for (uint i = 0u; i < sampleCount; ++i) {
+		vec2 Xi = Hammersley(i, sampleCount);
 		vec3 H = ImportanceSampleGGX(Xi, N, roughness);
 		vec3 L = normalize(2.0 * dot(V, H) * H - V);
 
 		float NdotL = max(dot(N, L), 0.0);
 		if (NdotL > 0.0) {
-			prefilteredColor += texture(environmentMap, L).rgb * NdotL;
+			// With N = V the sample pdf reduces to D / 4; read from the mip whose texels cover the sample's solid angle
+			float pdf = D_GGX(max(dot(N, H), 0.0), roughness) / 4.0;
+			float saSample = 1.0 / (float(sampleCount) * pdf + 0.0001);
+			float lod = roughness == 0.0 ? minLod : max(0.5 * log2(saSample / saTexel) + 1.0, minLod);
+
+			prefilteredColor += textureLod(environmentMap, L, lod).rgb * NdotL;
 			totalWeight += NdotL;
 		}
 	}
 	prefilteredColor = prefilteredColor / totalWeight;
 
 	outColour = vec4(prefilteredColor, 1.0);
-}
\ No newline at end of file
+}
@@ -0,0 +1,19 @@
+#version 460 core
+#extension GL_ARB_shader_viewport_layer_array : require
+
+// Renders every cube face in one draw, instance i goes to face i
+
+layout(location = 0) in vec3 pos;
+
+layout(std140, binding = 1) uniform CubeCameras {
+	mat4 proj;
+	mat4 views[6];
+};
+
+layout(location = 0) out vec3 outPos;
+
+void main() {
+	outPos = pos;
+	gl_Position = (proj * mat4(mat3(views[gl_InstanceID])) * vec4(pos, 1)).xyww;
+	gl_Layer = gl_InstanceID;
+}
@@ -0,0 +1,19 @@
+#version 460 core
+
+// skybox_layered.vert for drivers without ARB_shader_viewport_layer_array, layered.geom sets the face
+
+layout(location = 0) in vec3 pos;
+
+layout(std140, binding = 1) uniform CubeCameras {
+	mat4 proj;
+	mat4 views[6];
+};
+
+layout(location = 0) out vec3 outPos;
+layout(location = 1) flat out int outLayer;
+
+void main() {
+	outPos = pos;
+	gl_Position = (proj * mat4(mat3(views[gl_InstanceID])) * vec4(pos, 1)).xyww;
+	outLayer = gl_InstanceID;
+}
@@ -1,27 +1,143 @@
 #include "engine.hpp"
+#include <algorithm>
 #include <chrono>
+#include <imgui.h>
+#include <thread>
 
-Engine* Engine::inst = nullptr;
+#include "triple_buffer.hpp"
 
-Engine::Engine() : render(window.getRender()) {}
+Engine* Engine::inst = nullptr;
 
-void Engine::run() {
-	float time = 0;
-	auto past = std::chrono::high_resolution_clock::now();
+Engine::Engine() : window(jobs), render(window.getRender()), registry(jobs) {}
 
+void Engine::run(bool pipelined) {
 	// Loop will continue until "X" on window is clicked.
 	// We may want more complex closing behaviour
+	if (pipelined)
+		run_pipelined();
+	else
+		run_serial();
+}
+
+void Engine::run_serial() {
+	Window::Input input;
+	Frame frame;
+	auto past = std::chrono::high_resolution_clock::now();
 	while (!window.shouldClose()) {
 		window.beginFrame();
+		input.clearDeltas();
+		window.addInput(input);
 
 		auto now = std::chrono::high_resolution_clock::now();
 		double timestep = std::chrono::duration_cast<std::chrono::duration<double>>(now - past).count();
 		past = now;
 
-		time += timestep;
+		simulate(frame, input, timestep);
+		apply(frame);
+		draw_system_timeline(frame);
 
-		e_manager.update(timestep);
+		window.endFrame();
+	}
+}
+
+// The simulation steps frame N+1 while this thread draws frame N. Frames go one way and input the other through
+// triple buffers, so neither thread locks, and the simulation only waits when it's a whole frame ahead
+void Engine::run_pipelined() {
+	TripleBuffer<Window::Input> inputs;
+	TripleBuffer<Frame> frames;
+	std::atomic<bool> stopping = false, exited = false;
+
+	std::thread simulation([&] {
+		auto past = std::chrono::high_resolution_clock::now();
+		while (!stopping.load(std::memory_order_relaxed)) {
+			// The last step used up the deltas, unless there's newer input
+			if (!inputs.acquire())
+				inputs.front().clearDeltas();
+
+			auto now = std::chrono::high_resolution_clock::now();
+			double timestep = std::chrono::duration_cast<std::chrono::duration<double>>(now - past).count();
+			past = now;
+
+			simulate(frames.back(), inputs.front(), timestep);
+			frames.publish();
+		}
+		exited.store(true, std::memory_order_release);
+	});
+
+	while (!window.shouldClose()) {
+		window.beginFrame();
+		window.addInput(inputs.back());
+		if (inputs.try_publish())
+			inputs.back().clearDeltas();
+
+		// Without a new step the last one is drawn again
+		if (frames.acquire())
+			apply(frames.front());
+		draw_system_timeline(frames.front());
 
 		window.endFrame();
 	}
-}
\ No newline at end of file
+
+	// The simulation may not see stopping until after it has published another frame and is waiting for this thread
+	// to take it, so frames are taken until it's out of the loop
+	stopping.store(true, std::memory_order_relaxed);
+	while (!exited.load(std::memory_order_acquire)) {
+		frames.acquire();
+		std::this_thread::yield();
+	}
+	simulation.join();
+}
+
+void Engine::simulate(Frame& frame, const Window::Input& input, double timestep) {
+	frame.scene.clear();
+	frame.cursorMode.reset();
+	currentFrame = &frame;
+	currentInput = &input;
+	registry.update(timestep);
+	frame.timeline = registry.timeline();
+}
+
+void Engine::apply(const Frame& frame) {
+	render.apply_snapshot(frame.scene);
+	if (frame.cursorMode)
+		window.setCursorMode(*frame.cursorMode);
+}
+
+// One row per thread that ran a system in the last entity update, with each system as a bar across the update's span
+void Engine::draw_system_timeline(const Frame& frame) {
+	auto& timeline = frame.timeline;
+	if (timeline.empty())
+		return;
+
+	std::vector<unsigned> threads;
+	double end = 0;
+	for (auto& timing : timeline) {
+		threads.push_back(timing.thread);
+		end = std::max(end, timing.end);
+	}
+	std::sort(threads.begin(), threads.end());
+	threads.erase(std::unique(threads.begin(), threads.end()), threads.end());
+
+	ImGui::SetNextWindowPos(ImVec2(0, ImGui::GetIO().DisplaySize.y), ImGuiCond_FirstUseEver, ImVec2(0, 1));
+	ImGui::Begin("Systems", nullptr, ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoFocusOnAppearing);
+	ImGui::Text("Entity update: %.3f ms on %zu threads", end, threads.size());
+
+	const float width = 400, rowHeight = ImGui::GetTextLineHeightWithSpacing();
+	ImVec2 origin = ImGui::GetCursorScreenPos();
+	ImDrawList* draw = ImGui::GetWindowDrawList();
+	for (auto& timing : timeline) {
+		size_t row = std::lower_bound(threads.begin(), threads.end(), timing.thread) - threads.begin();
+		ImVec2 min(origin.x + static_cast<float>(width * timing.start / end), origin.y + rowHeight * row);
+		ImVec2 max(
+			std::max(origin.x + static_cast<float>(width * timing.end / end), min.x + 1), min.y + rowHeight - 1);
+		draw->AddRectFilled(min, max, IM_COL32(70, 130, 200, 255));
+		draw->PushClipRect(min, max, true);
+		draw->AddText(ImVec2(min.x + 2, min.y), IM_COL32_WHITE, timing.name);
+		draw->PopClipRect();
+		if (ImGui::IsMouseHoveringRect(min, max))
+			ImGui::SetTooltip(
+				"%s: %.3f ms on thread %u", timing.name, timing.end - timing.start, timing.thread);
+	}
+	ImGui::Dummy(ImVec2(width, rowHeight * threads.size()));
+	ImGui::End();
+}
@@ -1,22 +1,50 @@
 #pragma once
 
-#include "entities/entity_manager.hpp"
+#include "entities/registry.hpp"
+#include "job_system.hpp"
+#include "render/scene_snapshot.hpp"
 #include "window.hpp"
 
 class Engine {
+  public:
+	// What one step of the simulation hands to the thread owning the window and renderer. Systems declare the parts
+	// they write by type: the scene's sections, and Window::CursorMode
+	struct Frame {
+		Render::SceneSnapshot scene;
+		std::optional<Window::CursorMode> cursorMode;
+		std::vector<Registry::Timing> timeline;
+	};
+
   private:
 	Engine();
 	Engine(const Engine&) = delete;
 	static Engine* inst;
 
+	Frame* currentFrame = nullptr;
+	const Window::Input* currentInput = nullptr;
+	void simulate(Frame& frame, const Window::Input& input, double timestep);
+	void apply(const Frame& frame);
+	void run_serial();
+	void run_pipelined();
+
+	void draw_system_timeline(const Frame& frame);
+
   public:
 	static void init() { inst = new Engine(); };
 	static Engine* get_instance() { return inst; }
-	void run();
+	// Pipelined runs the entity systems on a thread of their own, a frame ahead of this one, which keeps the window
+	// and the GL context
+	void run(bool pipelined = false);
+
+	// For systems, the frame they record their changes to the renderer into and the input as of it
+	Frame& frame() { return *currentFrame; }
+	const Window::Input& input() { return *currentInput; }
 
   public:
+	// Before window, which the renderer lives in
+	JobSystem jobs;
 	Window window;
 	Render::Render& render;
-	EntityManager e_manager;
+	Registry registry;
 	double time;
-};
\ No newline at end of file
+};
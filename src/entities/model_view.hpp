@@ -1,34 +1,65 @@
 #pragma once
 
-#include "engine.hpp"
+#include "registry.hpp"
 #include "render/gltf.hpp"
 #include "render/import.hpp"
+#include "render/model.hpp"
+#include "render/scene_snapshot.hpp"
 
+#include <memory>
+#include <random>
 #include <string>
 
-class ModelView : public Entity {
-  private:
-	Render::Model model;
-	Render::TextureHandle skyboxTexture;
-	std::optional<Render::ModelInstance> modelInstance;
+struct ModelView {
+	std::unique_ptr<Render::ModelInstance> instance;
+};
 
-  public:
-	ModelView(
-		std::string modelPath = "assets/DamagedHelmet.glb",
-		std::string skyboxPath = "assets/neurathen_rock_castle_4k.hdr")
-		: model(Render::load_gltf(modelPath, Engine::get_instance()->render)),
-		  skyboxTexture(Render::importSkybox(skyboxPath)){};
-	void enter() override {
+// Local light circling the origin, from where it started
+struct LightOrbit {
+	glm::vec3 start;
+};
 
-		Engine::get_instance()->render.set_skybox_rect_texture(skyboxTexture);
+// Shows the model at the origin under the skybox, with stressLights local lights orbiting it to stress the light
+// clustering
+inline Entity model_view_create(
+	Registry& registry, Render::Render& render, std::string modelPath = "assets/DamagedHelmet.glb",
+	std::string skyboxPath = "assets/neurathen_rock_castle_4k.hdr", int stressLights = 0) {
+	Render::Model model = Render::load_gltf(modelPath, render);
+	render.set_skybox_rect_texture(Render::importSkybox(skyboxPath), true, Render::hash_file(skyboxPath));
 
-		modelInstance.emplace(model);
+	Entity entity = registry.create();
+	registry.emplace<ModelView>(entity, std::make_unique<Render::ModelInstance>(model));
 
-		float pi = glm::pi<float>();
-		Engine::get_instance()->render.dir_light_create({pi, pi, pi}, {1, 1, 1});
-		// render.create_dir_light({2, 2, 2}, {-1, 0, 1});
-		// render.create_dir_light({1, 1, 1}, {0, 0, -1});
+	float pi = glm::pi<float>();
+	render.dir_light_create({pi, pi, pi}, {1, 1, 1});
+	// render.create_dir_light({2, 2, 2}, {-1, 0, 1});
+	// render.create_dir_light({1, 1, 1}, {0, 0, -1});
+
+	std::mt19937 rng(stressLights);
+	std::uniform_real_distribution<float> position(-20, 20), hue(0, 1), range(1, 4);
+	for (int i = 0; i < stressLights; i++) {
+		glm::vec3 pos = {position(rng), position(rng) / 4, position(rng)};
+		glm::vec3 colour = glm::vec3{hue(rng), hue(rng), hue(rng)} * 2.0f;
+		Entity light = registry.create();
+		registry.emplace<LightOrbit>(light, pos);
+		if (i % 2)
+			registry.emplace<Render::SpotLightHandle>(
+				light, render.spot_light_create(colour, pos, {0, -1, 0}, range(rng), pi / 8, pi / 6));
+		else
+			registry.emplace<Render::PointLightHandle>(light, render.point_light_create(colour, pos, range(rng)));
 	}
+	return entity;
+}
 
-	void update(double) override {}
-};
\ No newline at end of file
+// Spins the orbiting lights around the vertical axis, time is in seconds since they started
+inline void light_orbit_system(Registry& registry, Render::SceneSnapshot::Lights& lights, double time) {
+	glm::mat4 spin = glm::rotate(glm::mat4(1.0f), static_cast<float>(time) / 4, {0, 1, 0});
+	registry.each<LightOrbit, Render::PointLightHandle>(
+		[&](Entity, LightOrbit& orbit, Render::PointLightHandle& light) {
+			lights.point_light_set_pos(light, glm::vec3(spin * glm::vec4(orbit.start, 1)));
+		});
+	registry.each<LightOrbit, Render::SpotLightHandle>(
+		[&](Entity, LightOrbit& orbit, Render::SpotLightHandle& light) {
+			lights.spot_light_set_pos(light, glm::vec3(spin * glm::vec4(orbit.start, 1)));
+		});
+}
@@ -1,41 +1,44 @@
 #pragma once
 
-#include "entity.hpp"
+#include "engine.hpp"
+#include "registry.hpp"
 #include "render/render.hpp"
-#include "window.hpp"
-#include <imgui.h>
 
-class OrbitCam : public Entity {
-  private:
-	const float speed = -1.0f / 200.0f;
+struct OrbitCam {
 	float xAngle = 0, yAngle = 0;
-	const float pi = glm::pi<float>();
-
 	float dist = 3;
-	const float scroll_speed = -1.0f / 2.0f;
-
-  public:
-	OrbitCam(){};
-	void enter() override { Engine::get_instance()->render.camera_set_fov(50); }
-
-	void update(double) override {
-		Window& window = Engine::get_instance()->window;
-		if (window.mouseButton(GLFW_MOUSE_BUTTON_LEFT)) {
-			window.setCursorMode(Window::CursorMode::Disabled);
-			xAngle += window.cursor.deltax * speed;
-			yAngle += window.cursor.deltay * speed;
-			yAngle = glm::clamp<float>(yAngle, -pi / 2, pi / 2);
-
-		} else {
-			window.setCursorMode(Window::CursorMode::Normal);
+
+	static constexpr float speed = -1.0f / 200.0f;
+	static constexpr float scrollSpeed = -1.0f / 2.0f;
+};
+
+inline Entity orbit_cam_create(Registry& registry, Render::Render& render) {
+	render.camera_set_fov(50);
+	Entity entity = registry.create();
+	registry.emplace<OrbitCam>(entity);
+	return entity;
+}
+
+// Turns the camera around the origin while the left mouse button is held, and zooms with the scroll wheel
+inline void orbit_cam_system(Registry& registry, const Window::Input& input, Engine::Frame& frame) {
+	const float pi = glm::pi<float>();
+	bool dragging = input.mouseButton(GLFW_MOUSE_BUTTON_LEFT);
+	frame.cursorMode = dragging ? Window::CursorMode::Disabled : Window::CursorMode::Normal;
+
+	registry.each<OrbitCam>([&](Entity, OrbitCam& cam) {
+		if (dragging) {
+			cam.xAngle += input.cursor.deltax * OrbitCam::speed;
+			cam.yAngle += input.cursor.deltay * OrbitCam::speed;
+			cam.yAngle = glm::clamp<float>(cam.yAngle, -pi / 2, pi / 2);
 		}
 
-		dist += window.scroll.deltay * scroll_speed;
-		dist = glm::max(dist, 0.0f);
+		cam.dist += input.scroll.deltay * OrbitCam::scrollSpeed;
+		cam.dist = glm::max(cam.dist, 0.0f);
 
-		glm::mat4 cameraPos = glm::rotate(glm::mat4(1.0f), xAngle, {0, 1, 0}) *
-			glm::rotate(glm::mat4(1.0f), yAngle, {1, 0, 0}) * glm::translate(glm::mat4(1.0f), glm::vec3({0, 0, dist}));
+		glm::mat4 cameraPos = glm::rotate(glm::mat4(1.0f), cam.xAngle, {0, 1, 0}) *
+			glm::rotate(glm::mat4(1.0f), cam.yAngle, {1, 0, 0}) *
+			glm::translate(glm::mat4(1.0f), glm::vec3({0, 0, cam.dist}));
 
-		Engine::get_instance()->render.camera_set_pos(cameraPos);
-	}
-};
\ No newline at end of file
+		frame.scene.camera.camera_set_pos(cameraPos);
+	});
+}
@@ -0,0 +1,82 @@
+#include "registry.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+void Registry::add_system(std::string name, Access access, std::function<void(Registry&, double)> run) {
+	access.reads.push_back(type_id<Entity>());
+
+	// Systems conflict when either writes something the other touches, and then run in the order they were added
+	auto touches = [](const Access& access, size_t type) {
+		return std::find(access.reads.begin(), access.reads.end(), type) != access.reads.end() ||
+			std::find(access.writes.begin(), access.writes.end(), type) != access.writes.end();
+	};
+	auto conflicts = [&](const Access& a, const Access& b) {
+		return std::any_of(a.writes.begin(), a.writes.end(), [&](size_t type) { return touches(b, type); }) ||
+			std::any_of(b.writes.begin(), b.writes.end(), [&](size_t type) { return touches(a, type); });
+	};
+
+	System system = {
+		.name = std::move(name),
+		.access = std::move(access),
+		.run = std::move(run),
+		.successors = {},
+		.dependencies = 0,
+	};
+	for (size_t i = 0; i < systems.size(); i++)
+		if (conflicts(systems[i].access, system.access)) {
+			systems[i].successors.push_back(systems.size());
+			system.dependencies++;
+		}
+	systems.push_back(std::move(system));
+}
+
+void Registry::update(double dTime) {
+	using Clock = std::chrono::steady_clock;
+	auto frameStart = Clock::now();
+	auto ms = [&](Clock::time_point time) {
+		return std::chrono::duration<double, std::milli>(time - frameStart).count();
+	};
+
+	timings.resize(systems.size());
+	std::vector<std::atomic<size_t>> remaining(systems.size());
+	for (size_t i = 0; i < systems.size(); i++)
+		remaining[i].store(systems[i].dependencies, std::memory_order_relaxed);
+	std::atomic<size_t> finished = 0;
+
+	std::function<void(size_t)> launch;
+	auto run = [&](size_t i) {
+		auto start = Clock::now();
+		systems[i].run(*this, dTime);
+		timings[i] = {systems[i].name.c_str(), jobs.current_thread(), ms(start), ms(Clock::now())};
+		for (size_t next : systems[i].successors)
+			if (remaining[next].fetch_sub(1, std::memory_order_acq_rel) == 1)
+				launch(next);
+		finished.fetch_add(1, std::memory_order_release);
+	};
+	launch = [&](size_t i) { jobs.run([&run, i] { run(i); }, nullptr, systems[i].name.c_str()); };
+
+	for (size_t i = 0; i < systems.size(); i++)
+		if (systems[i].dependencies == 0)
+			launch(i);
+	// This thread helps with the systems until they have all run
+	while (finished.load(std::memory_order_acquire) < systems.size())
+		if (!jobs.run_one())
+			std::this_thread::yield();
+
+	flush();
+}
+
+void Registry::flush() {
+	for (Entity entity : destroyed) {
+		if (!alive(entity))
+			continue;
+		run_destroy_hooks(entity.index);
+		for (auto& pool : ownedPools)
+			pool->remove(entity.index);
+		generations[entity.index]++;
+		freeIndices.push_back(entity.index);
+		count--;
+	}
+	destroyed.clear();
+}
@@ -0,0 +1,267 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "job_system.hpp"
+
+// An entity is an index into the registry's component pools, and a generation so stale copies can be told apart
+// once the index is reused
+struct Entity {
+	uint32_t index;
+	uint32_t generation;
+	bool operator==(const Entity&) const = default;
+};
+
+class ComponentPool {
+  public:
+	static constexpr uint32_t none = std::numeric_limits<uint32_t>::max();
+
+	virtual ~ComponentPool() {}
+	virtual bool contains(uint32_t entity) const = 0;
+	virtual void remove(uint32_t entity) = 0;
+	virtual size_t size() const = 0;
+	virtual const std::vector<uint32_t>& indices() const = 0;
+};
+
+// Components of one type packed together in a dense array, with a sparse array from entity index to dense slot.
+// Removal swaps the last component into the hole, so the dense array never has gaps
+template <class T> class SparseSet : public ComponentPool {
+	std::vector<uint32_t> sparse;
+	std::vector<uint32_t> entities;
+	std::vector<T> components;
+
+  public:
+	bool contains(uint32_t entity) const override { return entity < sparse.size() && sparse[entity] != none; }
+	size_t size() const override { return components.size(); }
+
+	template <class... Args> T& emplace(uint32_t entity, Args&&... args) {
+		if (contains(entity)) {
+			components[sparse[entity]] = T{std::forward<Args>(args)...};
+			return components[sparse[entity]];
+		}
+		if (entity >= sparse.size())
+			sparse.resize(entity + 1, none);
+		sparse[entity] = static_cast<uint32_t>(components.size());
+		entities.push_back(entity);
+		components.push_back(T{std::forward<Args>(args)...});
+		return components.back();
+	}
+
+	void remove(uint32_t entity) override {
+		if (!contains(entity))
+			return;
+		uint32_t slot = sparse[entity];
+		if (slot != components.size() - 1) {
+			components[slot] = std::move(components.back());
+			entities[slot] = entities.back();
+			sparse[entities[slot]] = slot;
+		}
+		components.pop_back();
+		entities.pop_back();
+		sparse[entity] = none;
+	}
+
+	T& get(uint32_t entity) { return components[sparse[entity]]; }
+	T* try_get(uint32_t entity) { return contains(entity) ? &components[sparse[entity]] : nullptr; }
+
+	// Entity indices and components in the same order
+	const std::vector<uint32_t>& indices() const override { return entities; }
+	std::vector<T>& data() { return components; }
+};
+
+// Entities with sparse set component storage. Systems declare the component types they read and write, and update()
+// runs each as soon as every earlier system it conflicts with has finished, on the job system's workers
+class Registry {
+	JobSystem& jobs;
+
+	std::vector<uint32_t> generations;
+	std::vector<uint32_t> freeIndices;
+	std::vector<Entity> destroyed;
+	size_t count = 0;
+	// By component type id, called with an entity index that has the component, just before it's removed
+	std::vector<std::pair<size_t, std::function<void(uint32_t)>>> destroyHooks;
+	void run_destroy_hooks(uint32_t entity, size_t type = std::numeric_limits<size_t>::max()) {
+		for (auto& [hookType, hook] : destroyHooks)
+			if (type == std::numeric_limits<size_t>::max() || hookType == type)
+				hook(entity);
+	}
+
+	// By component type id. Pools are created on first use, from whichever system gets there first, so the table
+	// never moves and creation takes a lock
+	static constexpr size_t maxTypes = 256;
+	std::array<std::atomic<ComponentPool*>, maxTypes> pools = {};
+	std::vector<std::unique_ptr<ComponentPool>> ownedPools;
+	std::mutex poolMutex;
+
+	static size_t next_type_id() {
+		static std::atomic<size_t> next = 0;
+		size_t id = next++;
+		// Checked in release builds too, as the pool table would be indexed past its end
+		if (id >= maxTypes) {
+			fprintf(stderr, "Error: more than %zu component types\n", maxTypes);
+			abort();
+		}
+		return id;
+	}
+	template <class T> static size_t type_id() {
+		static const size_t id = next_type_id();
+		return id;
+	}
+
+	template <class T> SparseSet<T>& pool() {
+		size_t id = type_id<T>();
+		ComponentPool* set = pools[id].load(std::memory_order_acquire);
+		if (!set) {
+			std::lock_guard lock(poolMutex);
+			set = pools[id].load(std::memory_order_relaxed);
+			if (!set) {
+				set = ownedPools.emplace_back(std::make_unique<SparseSet<T>>()).get();
+				pools[id].store(set, std::memory_order_release);
+			}
+		}
+		return static_cast<SparseSet<T>&>(*set);
+	}
+
+	template <class T, class... Ts> const ComponentPool& smallest_pool() {
+		const ComponentPool* smallest = &pool<T>();
+		[[maybe_unused]] auto consider = [&](const ComponentPool& set) {
+			if (set.size() < smallest->size())
+				smallest = &set;
+		};
+		(consider(pool<Ts>()), ...);
+		return *smallest;
+	}
+
+	// each() over positions [begin, end) of indices, which come from the smallest pool
+	template <class T, class... Ts, class F>
+	void each_in(const std::vector<uint32_t>& indices, size_t begin, size_t end, F& f) {
+		SparseSet<T>& first = pool<T>();
+		if constexpr (sizeof...(Ts) == 0) {
+			auto& data = first.data();
+			for (size_t i = begin; i < end; i++)
+				f(Entity{indices[i], generations[indices[i]]}, data[i]);
+		} else {
+			std::tuple<SparseSet<Ts>&...> rest = {pool<Ts>()...};
+			for (size_t i = begin; i < end; i++) {
+				uint32_t index = indices[i];
+				if (first.contains(index) && (std::get<SparseSet<Ts>&>(rest).contains(index) && ...))
+					f(
+						Entity{index, generations[index]}, first.get(index),
+						std::get<SparseSet<Ts>&>(rest).get(index)...);
+			}
+		}
+	}
+
+  public:
+	// What a system touches. Any type can stand for a resource outside the registry, like the renderer, so systems
+	// sharing it are kept apart. Systems that create or destroy entities write Entity, which every system reads
+	class Access {
+		friend Registry;
+		std::vector<size_t> reads, writes;
+
+	  public:
+		template <class... Ts> Access& read() {
+			(reads.push_back(type_id<Ts>()), ...);
+			return *this;
+		}
+		template <class... Ts> Access& write() {
+			(writes.push_back(type_id<Ts>()), ...);
+			return *this;
+		}
+	};
+
+	// When each system ran in the last update(), in milliseconds from its start
+	struct Timing {
+		const char* name;
+		// As in JobSystem::Trace
+		unsigned thread;
+		double start, end;
+	};
+
+  private:
+	struct System {
+		std::string name;
+		Access access;
+		std::function<void(Registry&, double)> run;
+		// Later systems that conflict with this one, and how many earlier ones this waits for
+		std::vector<size_t> successors;
+		size_t dependencies = 0;
+	};
+	std::vector<System> systems;
+	std::vector<Timing> timings;
+
+  public:
+	explicit Registry(JobSystem& jobs) : jobs(jobs) {}
+	Registry(const Registry&) = delete;
+
+	Entity create() {
+		count++;
+		if (!freeIndices.empty()) {
+			uint32_t index = freeIndices.back();
+			freeIndices.pop_back();
+			return {index, generations[index]};
+		}
+		generations.push_back(0);
+		return {static_cast<uint32_t>(generations.size() - 1), 0};
+	}
+	bool alive(Entity entity) const {
+		return entity.index < generations.size() && generations[entity.index] == entity.generation;
+	}
+	// The entity and its components stay until every system has finished
+	void destroy(Entity entity) { destroyed.push_back(entity); }
+	size_t size() const { return count; }
+
+	template <class T, class... Args> T& emplace(Entity entity, Args&&... args) {
+		return pool<T>().emplace(entity.index, std::forward<Args>(args)...);
+	}
+	template <class T> void remove(Entity entity) {
+		run_destroy_hooks(entity.index, type_id<T>());
+		pool<T>().remove(entity.index);
+	}
+	template <class T> bool has(Entity entity) { return pool<T>().contains(entity.index); }
+	template <class T> T& get(Entity entity) { return pool<T>().get(entity.index); }
+	template <class T> T* try_get(Entity entity) { return alive(entity) ? pool<T>().try_get(entity.index) : nullptr; }
+
+	// Calls f(entity, components...) for every entity with all of the components. The smallest pool is walked in
+	// order and the rest looked up, so a single component type is a straight pass over its array. f mustn't add or
+	// remove these component types
+	template <class T, class... Ts, class F> void each(F&& f) {
+		auto& indices = smallest_pool<T, Ts...>().indices();
+		each_in<T, Ts...>(indices, 0, indices.size(), f);
+	}
+	// each() split across the jobs, so f is called from several threads at once
+	template <class T, class... Ts, class F> void each_parallel(F&& f, size_t grain = 1024) {
+		auto& indices = smallest_pool<T, Ts...>().indices();
+		jobs.parallel_for(
+			indices.size(), grain, [&](size_t begin, size_t end) { each_in<T, Ts...>(indices, begin, end, f); },
+			"Each");
+	}
+
+	// Calls f on a T before it's removed, with remove() or along with its entity, for components owning something
+	// outside the registry
+	template <class T> void on_destroy(std::function<void(Entity, T&)> f) {
+		destroyHooks.emplace_back(type_id<T>(), [this, f = std::move(f)](uint32_t entity) {
+			if (T* component = pool<T>().try_get(entity))
+				f(Entity{entity, generations[entity]}, *component);
+		});
+	}
+
+	void add_system(std::string name, Access access, std::function<void(Registry&, double)> run);
+
+	// Runs every system, then removes the entities destroyed meanwhile
+	void update(double dTime);
+	void flush();
+
+	const std::vector<Timing>& timeline() const { return timings; }
+};
@@ -0,0 +1,131 @@
+#include "job_system.hpp"
+
+// The pool and worker the current thread belongs to, if any
+static thread_local const JobSystem* currentSystem = nullptr;
+static thread_local unsigned currentThread = 0;
+
+JobSystem::JobSystem(unsigned workerCount) {
+	queues.resize(workerCount + 1);
+	for (auto& queue : queues)
+		queue = std::make_unique<Queue>();
+	workers.reserve(workerCount);
+	for (unsigned i = 1; i <= workerCount; i++)
+		workers.emplace_back([this, i] { worker_loop(i); });
+}
+
+JobSystem::~JobSystem() {
+	{
+		std::lock_guard lock(sleepMutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (auto& worker : workers)
+		worker.join();
+}
+
+unsigned JobSystem::current_thread() const { return currentSystem == this ? currentThread : 0; }
+
+void JobSystem::run(std::function<void()> job, Counter* counter, const char* name) {
+	if (counter)
+		counter->pending.fetch_add(1, std::memory_order_relaxed);
+	push({std::move(job), counter, name});
+}
+
+void JobSystem::run_after(Counter& after, std::function<void()> job, Counter* counter, const char* name) {
+	if (counter)
+		counter->pending.fetch_add(1, std::memory_order_relaxed);
+	{
+		std::lock_guard lock(after.mutex);
+		if (!after.done()) {
+			after.continuations.push_back({std::move(job), counter, name});
+			return;
+		}
+	}
+	push({std::move(job), counter, name});
+}
+
+void JobSystem::push(Job job) {
+	queued.fetch_add(1, std::memory_order_release);
+	{
+		Queue& queue = *queues[current_thread()];
+		std::lock_guard lock(queue.mutex);
+		queue.jobs.push_back(std::move(job));
+	}
+	// Taking the lock orders this against a worker about to sleep, so it can't miss the job
+	{
+		std::lock_guard lock(sleepMutex);
+	}
+	wake.notify_one();
+}
+
+bool JobSystem::try_run(unsigned thread) {
+	Job job;
+	bool found = false;
+	{
+		Queue& own = *queues[thread];
+		std::lock_guard lock(own.mutex);
+		if (!own.jobs.empty()) {
+			job = std::move(own.jobs.back());
+			own.jobs.pop_back();
+			found = true;
+		}
+	}
+	for (size_t i = 1; i < queues.size() && !found; i++) {
+		Queue& victim = *queues[(thread + i) % queues.size()];
+		std::lock_guard lock(victim.mutex);
+		if (!victim.jobs.empty()) {
+			job = std::move(victim.jobs.front());
+			victim.jobs.pop_front();
+			found = true;
+		}
+	}
+	if (!found)
+		return false;
+	queued.fetch_sub(1, std::memory_order_relaxed);
+
+	if (traceHook) {
+		auto start = std::chrono::steady_clock::now();
+		job.run();
+		traceHook({job.name, thread, start, std::chrono::steady_clock::now()});
+	} else {
+		job.run();
+	}
+	// The waiter may return as soon as the count drops, so nothing of the job can be touched after it
+	job.run = nullptr;
+	if (job.counter)
+		finish(*job.counter);
+	return true;
+}
+
+void JobSystem::finish(Counter& counter) {
+	std::vector<Job> next;
+	{
+		// wait() takes the lock before returning, so the counter outlives this
+		std::lock_guard lock(counter.mutex);
+		if (counter.pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			next.swap(counter.continuations);
+	}
+	for (auto& job : next)
+		push(std::move(job));
+}
+
+void JobSystem::wait(Counter& counter) {
+	unsigned thread = current_thread();
+	while (!counter.done())
+		if (!try_run(thread))
+			std::this_thread::yield();
+	std::lock_guard lock(counter.mutex);
+}
+
+void JobSystem::worker_loop(unsigned thread) {
+	currentSystem = this;
+	currentThread = thread;
+	while (true) {
+		if (try_run(thread))
+			continue;
+		std::unique_lock lock(sleepMutex);
+		wake.wait(lock, [&] { return stopping || queued.load(std::memory_order_acquire) > 0; });
+		if (stopping)
+			return;
+	}
+}
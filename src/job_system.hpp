@@ -0,0 +1,102 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work stealing thread pool. Each worker pushes and pops jobs at the back of its own deque, and when that runs dry
+// steals from the front of the others'. Threads outside the pool, like the one owning the GL context, share one more
+// deque and run jobs themselves while they wait, so anything but GL calls can be handed out from them.
+class JobSystem {
+	struct Job;
+
+  public:
+	// Jobs in a group still to finish. Waiting on a counter runs other jobs instead of blocking, and jobs can be
+	// queued to start once it reaches zero. Only destroy one once wait() on it has returned
+	class Counter {
+		friend JobSystem;
+		std::atomic<size_t> pending = 0;
+		// Guards continuations against the last job finishing
+		std::mutex mutex;
+		std::vector<Job> continuations;
+
+	  public:
+		bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+	};
+
+	struct Trace {
+		const char* name;
+		// 0 for threads outside the pool, workers count from 1
+		unsigned thread;
+		std::chrono::steady_clock::time_point start, end;
+	};
+
+  private:
+	struct Job {
+		std::function<void()> run;
+		Counter* counter;
+		const char* name;
+	};
+	struct Queue {
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+	// Indexed by thread as in Trace
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<std::thread> workers;
+
+	std::atomic<size_t> queued = 0;
+	bool stopping = false;
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+
+	std::function<void(const Trace&)> traceHook;
+
+	void push(Job job);
+	void finish(Counter& counter);
+	bool try_run(unsigned thread);
+	void worker_loop(unsigned thread);
+
+  public:
+	// By default a worker for every hardware thread but the one creating it
+	explicit JobSystem(unsigned workerCount = std::max(std::thread::hardware_concurrency(), 2u) - 1);
+	~JobSystem();
+	JobSystem(const JobSystem&) = delete;
+
+	unsigned worker_count() const { return static_cast<unsigned>(workers.size()); }
+	// The calling thread's index, as in Trace
+	unsigned current_thread() const;
+
+	// name labels the job's traces, and must outlive it
+	void run(std::function<void()> job, Counter* counter = nullptr, const char* name = "Job");
+	// Queues job once every job in after has finished, or right away if they all have. counter counts it from now
+	void run_after(Counter& after, std::function<void()> job, Counter* counter = nullptr, const char* name = "Job");
+	void wait(Counter& counter);
+	// Runs one queued job on this thread if there are any, for threads waiting on something other than a counter
+	bool run_one() { return try_run(current_thread()); }
+
+	// Calls f(begin, end) over chunks of up to grain indices covering [0, count), on the workers and the calling
+	// thread, and returns once every chunk has run
+	template <class F> void parallel_for(size_t count, size_t grain, F&& f, const char* name = "Parallel for") {
+		if (count <= grain || workers.empty()) {
+			if (count > 0)
+				f(size_t(0), count);
+			return;
+		}
+		Counter counter;
+		for (size_t begin = grain; begin < count; begin += grain)
+			run([&f, begin, end = std::min(begin + grain, count)] { f(begin, end); }, &counter, name);
+		f(size_t(0), grain);
+		wait(counter);
+	}
+
+	// Called on whichever thread ran each job, so it must be thread safe. Only set it while no jobs are running
+	void set_trace_hook(std::function<void(const Trace&)> hook) { traceHook = std::move(hook); }
+};
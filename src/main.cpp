@@ -11,12 +11,45 @@ int main(int argc, char* argv[]) {
 
 	Engine::init();
 
-	if (args.size() > 1) {
-		Engine::get_instance()->e_manager.addEntity(std::make_unique<ModelView>(args.at(1)));
-	} else {
-		Engine::get_instance()->e_manager.addEntity(std::make_unique<ModelView>());
-	}
-	Engine::get_instance()->e_manager.addEntity(std::make_unique<OrbitCam>());
+	// --stress-lights fills the scene with 4096 local lights
+	bool stressLights = std::erase(args, "--stress-lights") > 0;
+	// --pipelined runs the entity systems a frame ahead of rendering, on a thread of their own
+	bool pipelined = std::erase(args, "--pipelined") > 0;
+	// --gpu-culling culls and builds the draws in a compute pass
+	if (std::erase(args, "--gpu-culling") > 0)
+		Engine::get_instance()->render.set_culling_mode(Render::Render::CullingMode::GPU);
+	// --no-occlusion turns off Hi-Z occlusion culling, to compare against
+	if (std::erase(args, "--no-occlusion") > 0)
+		Engine::get_instance()->render.set_occlusion_culling(false);
 
-	Engine::get_instance()->run();
-}
\ No newline at end of file
+	Engine& engine = *Engine::get_instance();
+	Registry& registry = engine.registry;
+	model_view_create(
+		registry, engine.render, args.size() > 1 ? args.at(1) : "assets/DamagedHelmet.glb",
+		"assets/neurathen_rock_castle_4k.hdr", stressLights ? 4096 : 0);
+	orbit_cam_create(registry, engine.render);
+
+	// They record into different parts of the frame handed to the renderer, so they can run side by side
+	registry.add_system(
+		"Orbit camera", Registry::Access().write<OrbitCam, Render::SceneSnapshot::Camera, Window::CursorMode>(),
+		[&engine](Registry& registry, double) { orbit_cam_system(registry, engine.input(), engine.frame()); });
+	registry.add_system(
+		"Light orbits",
+		Registry::Access()
+			.read<LightOrbit, Render::PointLightHandle, Render::SpotLightHandle>()
+			.write<Render::SceneSnapshot::Lights>(),
+		[&engine, time = 0.0](Registry& registry, double dTime) mutable {
+			time += dTime;
+			light_orbit_system(registry, engine.frame().scene.lights, time);
+		});
+
+	// Entities are removed at the end of an update, on the simulation's thread, so their lights go with the frame
+	registry.on_destroy<Render::PointLightHandle>([&engine](Entity, Render::PointLightHandle& light) {
+		engine.frame().scene.lights.point_light_delete(std::move(light));
+	});
+	registry.on_destroy<Render::SpotLightHandle>([&engine](Entity, Render::SpotLightHandle& light) {
+		engine.frame().scene.lights.spot_light_delete(std::move(light));
+	});
+
+	engine.run(pipelined);
+}
@@ -0,0 +1,324 @@
+#include "bvh.hpp"
+
+#include <algorithm>
+#include <array>
+
+namespace Render {
+
+// In double precision, boxes can span the whole float range without the areas overflowing
+static double surface_area(glm::vec3 min, glm::vec3 max) {
+	double x = static_cast<double>(max.x) - min.x;
+	double y = static_cast<double>(max.y) - min.y;
+	double z = static_cast<double>(max.z) - min.z;
+	return 2 * (x * y + y * z + z * x);
+}
+
+uint32_t SurfaceBVH::allocate_node() {
+	if (!freeNodes.empty()) {
+		uint32_t node = freeNodes.back();
+		freeNodes.pop_back();
+		return node;
+	}
+	nodes.emplace_back();
+	return static_cast<uint32_t>(nodes.size() - 1);
+}
+
+void SurfaceBVH::refit_from(uint32_t node) {
+	for (; node != none; node = nodes[node].parent) {
+		Node& n = nodes[node];
+		innerArea -= surface_area(n.min, n.max);
+		n.min = glm::min(nodes[n.left].min, nodes[n.right].min);
+		n.max = glm::max(nodes[n.left].max, nodes[n.right].max);
+		innerArea += surface_area(n.min, n.max);
+	}
+}
+
+void SurfaceBVH::insert_leaf(uint32_t leaf) {
+	if (root == none) {
+		root = leaf;
+		nodes[leaf].parent = none;
+		return;
+	}
+
+	// Walk down towards the sibling that adds the least area, stopping when pairing with the current node is cheaper
+	// than anything below it could be
+	glm::vec3 min = nodes[leaf].min, max = nodes[leaf].max;
+	uint32_t sibling = root;
+	while (!nodes[sibling].is_leaf()) {
+		const Node& node = nodes[sibling];
+		double area = surface_area(node.min, node.max);
+		double combined = surface_area(glm::min(node.min, min), glm::max(node.max, max));
+		double cost = 2 * combined;
+		double inherited = 2 * (combined - area);
+		auto descend_cost = [&](uint32_t child) {
+			const Node& c = nodes[child];
+			double enlarged = surface_area(glm::min(c.min, min), glm::max(c.max, max));
+			return inherited + (c.is_leaf() ? enlarged : enlarged - surface_area(c.min, c.max));
+		};
+		double leftCost = descend_cost(node.left), rightCost = descend_cost(node.right);
+		if (cost < leftCost && cost < rightCost)
+			break;
+		sibling = leftCost < rightCost ? node.left : node.right;
+	}
+
+	uint32_t oldParent = nodes[sibling].parent;
+	uint32_t parent = allocate_node();
+	nodes[parent] = {.min = {}, .parent = oldParent, .max = {}, .left = sibling, .right = leaf};
+	nodes[sibling].parent = parent;
+	nodes[leaf].parent = parent;
+	if (oldParent == none)
+		root = parent;
+	else if (nodes[oldParent].left == sibling)
+		nodes[oldParent].left = parent;
+	else
+		nodes[oldParent].right = parent;
+	refit_from(parent);
+}
+
+void SurfaceBVH::remove_leaf(uint32_t leaf) {
+	if (leaf == root) {
+		root = none;
+		return;
+	}
+
+	// The leaf's sibling takes its parent's place
+	uint32_t parent = nodes[leaf].parent;
+	uint32_t grandparent = nodes[parent].parent;
+	innerArea -= surface_area(nodes[parent].min, nodes[parent].max);
+	uint32_t sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+	nodes[sibling].parent = grandparent;
+	if (grandparent == none) {
+		root = sibling;
+	} else {
+		if (nodes[grandparent].left == parent)
+			nodes[grandparent].left = sibling;
+		else
+			nodes[grandparent].right = sibling;
+		refit_from(grandparent);
+	}
+	freeNodes.push_back(parent);
+}
+
+void SurfaceBVH::insert(size_t handle, glm::vec3 min, glm::vec3 max) {
+	if (handle >= leaves.size())
+		leaves.resize(handle + 1, none);
+	uint32_t leaf = allocate_node();
+	nodes[leaf] = {.min = min, .parent = none, .max = max, .left = none, .right = static_cast<uint32_t>(handle)};
+	leaves[handle] = leaf;
+	leafCount++;
+	changed = true;
+	insert_leaf(leaf);
+}
+
+void SurfaceBVH::remove(size_t handle) {
+	if (!contains(handle))
+		return;
+	uint32_t leaf = leaves[handle];
+	remove_leaf(leaf);
+	freeNodes.push_back(leaf);
+	leaves[handle] = none;
+	leafCount--;
+	changed = true;
+}
+
+void SurfaceBVH::update(size_t handle, glm::vec3 min, glm::vec3 max) {
+	if (!contains(handle)) {
+		insert(handle, min, max);
+		return;
+	}
+	Node& leaf = nodes[leaves[handle]];
+	if (leaf.min == min && leaf.max == max)
+		return;
+	leaf.min = min;
+	leaf.max = max;
+	changed = true;
+	refit_from(leaf.parent);
+}
+
+uint32_t SurfaceBVH::build(std::vector<BuildRef>& refs, size_t begin, size_t end) {
+	if (end - begin == 1)
+		return refs[begin].node;
+
+	glm::vec3 centroidMin(std::numeric_limits<float>::max()), centroidMax(std::numeric_limits<float>::lowest());
+	for (size_t i = begin; i < end; i++) {
+		centroidMin = glm::min(centroidMin, refs[i].centroid);
+		centroidMax = glm::max(centroidMax, refs[i].centroid);
+	}
+	glm::vec3 extent = centroidMax - centroidMin;
+	int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+	// Bin the centroids along the longest axis and split where count times area is least on both sides. When every
+	// centroid is the same any split is as good as another
+	size_t mid = begin + (end - begin) / 2;
+	if (extent[axis] > 0) {
+		const int binCount = 16;
+		struct Bin {
+			glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+			glm::vec3 max = glm::vec3(std::numeric_limits<float>::lowest());
+			size_t count = 0;
+		};
+		std::array<Bin, binCount> bins;
+		float scale = binCount / extent[axis];
+		auto bin_of = [&](const BuildRef& ref) {
+			return std::min(static_cast<int>((ref.centroid[axis] - centroidMin[axis]) * scale), binCount - 1);
+		};
+		for (size_t i = begin; i < end; i++) {
+			Bin& bin = bins[bin_of(refs[i])];
+			bin.min = glm::min(bin.min, nodes[refs[i].node].min);
+			bin.max = glm::max(bin.max, nodes[refs[i].node].max);
+			bin.count++;
+		}
+
+		std::array<double, binCount> leftCost;
+		Bin left;
+		for (int b = 0; b < binCount - 1; b++) {
+			left.min = glm::min(left.min, bins[b].min);
+			left.max = glm::max(left.max, bins[b].max);
+			left.count += bins[b].count;
+			leftCost[b] = left.count ? surface_area(left.min, left.max) * left.count : 0;
+		}
+		Bin right;
+		double bestCost = std::numeric_limits<double>::infinity();
+		int bestSplit = 0;
+		for (int b = binCount - 1; b > 0; b--) {
+			right.min = glm::min(right.min, bins[b].min);
+			right.max = glm::max(right.max, bins[b].max);
+			right.count += bins[b].count;
+			double cost = leftCost[b - 1] + (right.count ? surface_area(right.min, right.max) * right.count : 0);
+			if (right.count < end - begin && right.count > 0 && cost < bestCost) {
+				bestCost = cost;
+				bestSplit = b;
+			}
+		}
+		if (bestSplit > 0)
+			mid = std::partition(
+					  refs.begin() + begin, refs.begin() + end,
+					  [&](const BuildRef& ref) { return bin_of(ref) < bestSplit; }) -
+				refs.begin();
+	}
+
+	uint32_t node = allocate_node();
+	uint32_t left = build(refs, begin, mid);
+	uint32_t right = build(refs, mid, end);
+	nodes[node] = {
+		.min = glm::min(nodes[left].min, nodes[right].min),
+		.parent = none,
+		.max = glm::max(nodes[left].max, nodes[right].max),
+		.left = left,
+		.right = right};
+	nodes[left].parent = node;
+	nodes[right].parent = node;
+	return node;
+}
+
+void SurfaceBVH::rebuild() {
+	// Leaves keep their nodes, only the inner nodes are thrown away
+	std::vector<BuildRef> refs;
+	refs.reserve(leafCount);
+	std::vector<uint8_t> isLeaf(nodes.size(), 0);
+	for (uint32_t leaf : leaves) {
+		if (leaf == none)
+			continue;
+		refs.push_back({leaf, (nodes[leaf].min + nodes[leaf].max) * 0.5f});
+		isLeaf[leaf] = 1;
+	}
+	freeNodes.clear();
+	for (uint32_t i = static_cast<uint32_t>(nodes.size()); i-- > 0;)
+		if (!isLeaf[i])
+			freeNodes.push_back(i);
+
+	root = refs.empty() ? none : build(refs, 0, refs.size());
+	if (root != none)
+		nodes[root].parent = none;
+	// Rebuilding also clears whatever rounding the incremental sum has gathered
+	innerArea = inner_area();
+	builtCost = cost();
+	changed = false;
+}
+
+void SurfaceBVH::rebuild_if_degraded() {
+	if (!changed)
+		return;
+	changed = false;
+	if (builtCost == 0 || cost() > degradedCost * builtCost)
+		rebuild();
+}
+
+double SurfaceBVH::cost() const {
+	if (root == none)
+		return 0;
+	double rootArea = surface_area(nodes[root].min, nodes[root].max);
+	return rootArea == 0 ? 0 : innerArea / rootArea;
+}
+
+double SurfaceBVH::inner_area() const {
+	if (root == none)
+		return 0;
+	double total = 0;
+	std::vector<uint32_t> stack = {root};
+	while (!stack.empty()) {
+		const Node& node = nodes[stack.back()];
+		stack.pop_back();
+		if (node.is_leaf())
+			continue;
+		total += surface_area(node.min, node.max);
+		stack.push_back(node.left);
+		stack.push_back(node.right);
+	}
+	return total;
+}
+
+void SurfaceBVH::cull_subtree(
+	const FrustumTest& test, uint32_t subtree, uint32_t planes, std::vector<uint8_t>& visible) const {
+	// Each entry carries the planes its node still straddles; once a node is inside all of them its whole subtree is
+	std::vector<std::pair<uint32_t, uint32_t>> stack = {{subtree, planes}};
+	while (!stack.empty()) {
+		auto [index, active] = stack.back();
+		stack.pop_back();
+		const Node& node = nodes[index];
+		active = active ? test.classify(node.min, node.max, active) : 0;
+		if (active == FrustumTest::outside)
+			continue;
+		if (node.is_leaf()) {
+			visible[node.right] = 1;
+		} else {
+			stack.push_back({node.left, active});
+			stack.push_back({node.right, active});
+		}
+	}
+}
+
+void SurfaceBVH::cull(const FrustumPlanes& planes, std::vector<uint8_t>& visible, JobSystem& jobs) const {
+	visible.assign(leaves.size(), 0);
+	if (root == none)
+		return;
+	FrustumTest test(planes);
+
+	// Breadth first from the root until there are enough subtrees to share out. Each writes only its own leaves
+	std::vector<std::pair<uint32_t, uint32_t>> subtrees = {{root, FrustumTest::allPlanes}}, next;
+	while (leafCount >= parallelCullLeaves && !subtrees.empty() && subtrees.size() < cullSubtrees) {
+		next.clear();
+		for (auto [index, active] : subtrees) {
+			const Node& node = nodes[index];
+			active = active ? test.classify(node.min, node.max, active) : 0;
+			if (active == FrustumTest::outside)
+				continue;
+			if (node.is_leaf()) {
+				visible[node.right] = 1;
+			} else {
+				next.push_back({node.left, active});
+				next.push_back({node.right, active});
+			}
+		}
+		std::swap(subtrees, next);
+	}
+	jobs.parallel_for(
+		subtrees.size(), 1,
+		[&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++)
+				cull_subtree(test, subtrees[i].first, subtrees[i].second, visible);
+		},
+		"Frustum cull");
+}
+
+} // namespace Render
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "culling.hpp"
+#include "job_system.hpp"
+
+namespace Render {
+
+// Dynamic bounding volume hierarchy over surface boxes, keyed by surface handle with one surface per leaf.
+// rebuild() is a binned SAH build. insert, remove and update change the tree in place, and let it degrade until
+// rebuild_if_degraded() finds its SAH cost has grown too far past the last build's. The cost is kept up to date as
+// the tree changes, so checking it is cheap.
+class SurfaceBVH {
+	static constexpr uint32_t none = ~0u;
+
+	struct Node {
+		glm::vec3 min;
+		uint32_t parent;
+		glm::vec3 max;
+		// Leaves have no left child and keep their handle in right
+		uint32_t left, right;
+		bool is_leaf() const { return left == none; }
+	};
+	std::vector<Node> nodes;
+	std::vector<uint32_t> freeNodes;
+	uint32_t root = none;
+	// Leaf node of each handle, none for handles not in the tree
+	std::vector<uint32_t> leaves;
+	size_t leafCount = 0;
+
+	// Rebuilt once the cost is this many times the cost right after the last build
+	const double degradedCost = 1.5;
+	double builtCost = 0;
+	bool changed = false;
+	// Summed surface area of the inner nodes, the cost's numerator
+	double innerArea = 0;
+	double inner_area() const;
+
+	// Trees smaller than this are culled on the calling thread, larger ones are split into up to cullSubtrees
+	// subtrees walked across the jobs
+	static constexpr size_t parallelCullLeaves = 4096;
+	static constexpr size_t cullSubtrees = 64;
+	void cull_subtree(
+		const FrustumTest& test, uint32_t subtree, uint32_t planes, std::vector<uint8_t>& visible) const;
+
+	struct BuildRef {
+		uint32_t node;
+		glm::vec3 centroid;
+	};
+	uint32_t build(std::vector<BuildRef>& refs, size_t begin, size_t end);
+
+	uint32_t allocate_node();
+	void insert_leaf(uint32_t leaf);
+	void remove_leaf(uint32_t leaf);
+	void refit_from(uint32_t node);
+
+	// Slab test, the distance along the ray where it enters the node or infinity if it misses
+	static float ray_enter(const Node& node, glm::vec3 origin, glm::vec3 invDir) {
+		const float miss = std::numeric_limits<float>::infinity();
+		float enter = 0, leave = miss;
+		for (int axis = 0; axis < 3; axis++) {
+			// Parallel to the slab, where 0 * inf would be NaN. The ray is inside it all along or never
+			if (std::isinf(invDir[axis])) {
+				if (origin[axis] < node.min[axis] || origin[axis] > node.max[axis])
+					return miss;
+				continue;
+			}
+			float t0 = (node.min[axis] - origin[axis]) * invDir[axis];
+			float t1 = (node.max[axis] - origin[axis]) * invDir[axis];
+			enter = glm::max(enter, glm::min(t0, t1));
+			leave = glm::min(leave, glm::max(t0, t1));
+		}
+		return enter <= leave ? enter : miss;
+	}
+
+  public:
+	void insert(size_t handle, glm::vec3 min, glm::vec3 max);
+	void remove(size_t handle);
+	// Moves a leaf and refits its ancestors, handles not in the tree yet are inserted
+	void update(size_t handle, glm::vec3 min, glm::vec3 max);
+	bool contains(size_t handle) const { return handle < leaves.size() && leaves[handle] != none; }
+	size_t size() const { return leafCount; }
+	size_t node_count() const { return nodes.size() - freeNodes.size(); }
+
+	void rebuild();
+	// Checks the cost after any changes since the last call
+	void rebuild_if_degraded();
+	// Summed surface area of the inner nodes over the root's, the expected number of boxes a query tests
+	double cost() const;
+
+	// Sets visible[handle] for the leaves at least partly inside every plane, and clears it for every other handle
+	void cull(const FrustumPlanes& planes, std::vector<uint8_t>& visible, JobSystem& jobs) const;
+	// Whether one leaf is at least partly inside every plane
+	bool leaf_visible(size_t handle, const FrustumTest& test) const {
+		const Node& leaf = nodes[leaves[handle]];
+		return test.classify(leaf.min, leaf.max) != FrustumTest::outside;
+	}
+
+	// Calls f(handle) for each leaf whose box overlaps the query box
+	template <class F> void box_query(glm::vec3 min, glm::vec3 max, F&& f) const {
+		if (root == none)
+			return;
+		std::vector<uint32_t> stack = {root};
+		while (!stack.empty()) {
+			const Node& node = nodes[stack.back()];
+			stack.pop_back();
+			if (node.max.x < min.x || node.max.y < min.y || node.max.z < min.z || node.min.x > max.x ||
+				node.min.y > max.y || node.min.z > max.z)
+				continue;
+			if (node.is_leaf()) {
+				f(static_cast<size_t>(node.right));
+			} else {
+				stack.push_back(node.left);
+				stack.push_back(node.right);
+			}
+		}
+	}
+
+	// Calls f(handle, enter) for each leaf the ray enters before tMax, nearer nodes first. f returns the new tMax, so
+	// a hit cuts short the rest of the walk
+	template <class F> void ray_query(glm::vec3 origin, glm::vec3 dir, float tMax, F&& f) const {
+		if (root == none)
+			return;
+		glm::vec3 invDir = 1.0f / dir;
+		std::vector<std::pair<uint32_t, float>> stack = {{root, ray_enter(nodes[root], origin, invDir)}};
+		while (!stack.empty()) {
+			auto [index, enter] = stack.back();
+			stack.pop_back();
+			if (enter > tMax)
+				continue;
+			const Node& node = nodes[index];
+			if (node.is_leaf()) {
+				tMax = glm::min(tMax, f(static_cast<size_t>(node.right), enter));
+				continue;
+			}
+			std::pair<uint32_t, float> nearer = {node.left, ray_enter(nodes[node.left], origin, invDir)};
+			std::pair<uint32_t, float> further = {node.right, ray_enter(nodes[node.right], origin, invDir)};
+			if (further.second < nearer.second)
+				std::swap(nearer, further);
+			if (further.second <= tMax)
+				stack.push_back(further);
+			if (nearer.second <= tMax)
+				stack.push_back(nearer);
+		}
+	}
+};
+
+} // namespace Render
@@ -1,16 +1,43 @@
 #include "core.hpp"
 
 #include <algorithm>
+#include <bit>
+#include <cstring>
 
 #include "debug.hpp"
 #include "gl.hpp"
+#include "scene_snapshot.hpp"
 
 namespace Render {
+Core::AABB Core::transform_bounds(const AABB& bounds, const mat4& transform) {
+	// Arvo's method: each output extent is the sum of the extremes of every column's contribution
+	AABB result = {.min = vec3(transform[3]), .max = vec3(transform[3])};
+	for (int i = 0; i < 3; i++) {
+		vec3 a = vec3(transform[i]) * bounds.min[i];
+		vec3 b = vec3(transform[i]) * bounds.max[i];
+		result.min += min(a, b);
+		result.max += max(a, b);
+	}
+	return result;
+}
+
 void Core::meshes_setup(size_t) {}
-void Core::meshes_cleanup(size_t handle) {
-	auto& mesh = meshes_get(handle);
-	glDeleteVertexArrays(1, &(mesh.vao));
-	glDeleteBuffers(mesh.buffers.size(), mesh.buffers.data());
+void Core::meshes_cleanup(size_t handle) { meshPool.release(meshes_get(handle).range); }
+
+Core::MeshHandle
+Core::mesh_create(const std::vector<float>& vertices, const std::vector<uint32_t>& indices, AABB bounds) {
+	std::shared_ptr<MeshTriangles> triangles;
+	if (bounds.min != bounds.max) {
+		triangles = std::make_shared<MeshTriangles>();
+		triangles->positions.resize(vertices.size() / MeshPool::vertexFloats);
+		for (size_t i = 0; i < triangles->positions.size(); i++) {
+			const float* vertex = vertices.data() + i * MeshPool::vertexFloats;
+			triangles->positions[i] = {vertex[0], vertex[1], vertex[2]};
+		}
+		triangles->indices = indices;
+	}
+	return meshes_insert(
+		Mesh{.range = meshPool.allocate(vertices, indices), .bounds = bounds, .triangles = std::move(triangles)});
 }
 
 void Core::shaders_setup(size_t) {}
@@ -20,39 +47,212 @@ void Core::shaders_cleanup(size_t handle) {
 }
 
 void Core::materials_setup(size_t handle) {
+	drawListsDirty = true;
 	for (auto& shader_pass : materials_get(handle).shader_passes) {
 		shaders_get(shader_pass.shader).materials.emplace(handle);
 	}
 }
 void Core::materials_cleanup(size_t handle) {
 	// assert(materials_get(handle).surfaces.empty());
+	drawListsDirty = true;
 	for (auto& shader_pass : materials_get(handle).shader_passes) {
 		shaders_get(shader_pass.shader).materials.erase(handle);
 	}
 }
 
-void Core::surfaces_setup(size_t handle) { materials_get(surfaces_get(handle).material).surfaces.emplace(handle); }
-void Core::surfaces_cleanup(size_t handle) { materials_get(surfaces_get(handle).material).surfaces.erase(handle); }
+void Core::material_set_shader_passes(MaterialHandle& material, std::vector<Material::ShaderPass> shader_passes) {
+	materials_cleanup(material.handle);
+	materials_get(material).shader_passes = shader_passes;
+	materials_setup(material.handle);
+	// The shadow pass may have changed, or its alpha cutoff
+	for (size_t surface : materials_get(material).surfaces)
+		invalidate_shadows(surfaces_get(surface));
+}
+
+size_t Core::texture_set(const std::vector<TextureHandle>& textures) {
+	auto [it, inserted] = texture_set_lookup.try_emplace(textures, texture_sets.size());
+	if (inserted)
+		texture_sets.push_back(textures);
+	return it->second;
+}
+
+void Core::surfaces_setup(size_t handle) {
+	materials_get(surfaces_get(handle).material).surfaces.emplace(handle);
+	surfaces_dirty.push_back(handle);
+	drawListsDirty = true;
+	dynamicSurfaces += surfaces_get(handle).dynamic;
+	invalidate_shadows(surfaces_get(handle));
+}
+void Core::surfaces_cleanup(size_t handle) {
+	materials_get(surfaces_get(handle).material).surfaces.erase(handle);
+	if (surfaces_get(handle).node != std::numeric_limits<size_t>::max())
+		transform_nodes_get(surfaces_get(handle).node).surfaces.erase(handle);
+	surfaceTree.remove(handle);
+	unboundedSurfaces.erase(handle);
+	drawListsDirty = true;
+	dynamicSurfaces -= surfaces_get(handle).dynamic;
+	invalidate_shadows(surfaces_get(handle));
+}
+
+void Core::surface_set_dynamic(SurfaceHandle& handle, bool dynamic) {
+	auto& surface = surfaces_get(handle);
+	if (surface.dynamic == dynamic)
+		return;
+	surface.dynamic = false;
+	invalidate_shadows(surface);
+	surface.dynamic = dynamic;
+	dynamicSurfaces += dynamic ? 1 : -1;
+	surfaces_dirty.push_back(handle.handle);
+
+	if (dynamic && !dynamicShadows) {
+		dynamicShadows = true;
+		// Static casters so far were drawn straight into dirLightShadow. Recreating the atlas adds
+		// dirLightShadowStatic and invalidates every tile, so they're redrawn there on the next update
+		create_shadow_atlas();
+	}
+}
+
+static float luminance(vec3 colour) { return dot(colour, vec3{0.2126f, 0.7152f, 0.0722f}); }
+
+int Core::shadow_tile_size(vec3 colour, float maxLuminance) const {
+	// Tile area follows the light's share of the brightest light's luminance
+	float share = maxLuminance > 0 ? sqrt(luminance(colour) / maxLuminance) : 1;
+	int size = std::bit_floor(static_cast<unsigned>(max(maxShadowTileSize * share, 1.0f)));
+	return std::clamp(size, minShadowTileSize, maxShadowTileSize);
+}
+
+void Core::pack_shadow_atlas(const std::vector<int>& tileSizes) {
+	std::vector<int> sizes = tileSizes;
+	auto area = [&] {
+		size_t total = 0;
+		for (int size : sizes)
+			total += static_cast<size_t>(size) * size;
+		return total;
+	};
+	// Every tile is a power of two, so packed largest first they fit any square atlas at least their total area
+	size_t maxArea = static_cast<size_t>(maxShadowAtlasSize) * maxShadowAtlasSize;
+	while (area() > maxArea && *std::max_element(sizes.begin(), sizes.end()) > minShadowTileSize)
+		for (int& size : sizes)
+			size = std::max(size / 2, minShadowTileSize);
+
+	int atlasSize = 0;
+	if (!sizes.empty())
+		atlasSize = std::min<int>(
+			std::bit_ceil(static_cast<size_t>(ceil(sqrt(static_cast<double>(area()))))), maxShadowAtlasSize);
+	bool resized = atlasSize != shadowAtlas.size();
+	shadowAtlas.reset(atlasSize, minShadowTileSize);
+	if (resized)
+		create_shadow_atlas();
+
+	std::vector<size_t> order(sizes.size());
+	for (size_t i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sizes[a] > sizes[b]; });
+	for (size_t i : order) {
+		// Tiles that still don't fit are left out, and their cascades unshadowed
+		shadowCache[i].requestedSize = tileSizes[i];
+		shadowCache[i].tile = shadowAtlas.allocate(sizes[i]);
+		shadowCache[i].valid = false;
+	}
+}
+
+void Core::create_shadow_atlas() {
+	for (auto& cache : shadowCache)
+		cache.valid = false;
+
+	int size = shadowAtlas.size();
+	for (GLuint* texture : {&dirLightShadow, &dirLightShadowStatic}) {
+		if (*texture)
+			glDeleteTextures(1, texture);
+		*texture = 0;
+		if (size == 0 || (texture == &dirLightShadowStatic && !dynamicShadows))
+			continue;
+		glCreateTextures(GL_TEXTURE_2D, 1, texture);
+		glTextureStorage2D(*texture, 1, shadowDepthFormat, size, size);
+		glTextureParameteri(*texture, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glTextureParameteri(*texture, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+		glTextureParameteri(*texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTextureParameteri(*texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+}
+
+void Core::transform_nodes_setup(size_t) {}
+void Core::transform_nodes_cleanup(size_t handle) {
+	for (size_t surface : transform_nodes_get(handle).surfaces)
+		surfaces_get(surface).node = std::numeric_limits<size_t>::max();
+	transformHierarchy.remove(handle);
+}
+
+void Core::surface_set_node(SurfaceHandle& surface, TransformNodeHandle& node) {
+	surface_clear_node(surface);
+	surfaces_get(surface).node = node.handle;
+	transform_nodes_get(node).surfaces.emplace(surface.handle);
+	set_surface_transform(surface.handle, transformHierarchy.world(node.handle));
+}
+
+void Core::surface_clear_node(SurfaceHandle& surface) {
+	size_t& node = surfaces_get(surface).node;
+	if (node == std::numeric_limits<size_t>::max())
+		return;
+	transform_nodes_get(node).surfaces.erase(surface.handle);
+	node = std::numeric_limits<size_t>::max();
+}
+
+size_t Core::update_transforms() {
+	return transformHierarchy.update(jobs, [&](size_t node, const mat4& world) {
+		for (size_t surface : transform_nodes_get(node).surfaces)
+			set_surface_transform(surface, world);
+	});
+}
+
+void Core::apply_snapshot(const SceneSnapshot& snapshot) {
+	if (snapshot.camera.pos)
+		camera_set_pos(*snapshot.camera.pos);
+	for (auto& [light, pos] : snapshot.lights.points)
+		point_lights_get(light).pos = pos;
+	for (auto& [light, pos] : snapshot.lights.spots)
+		spot_lights_get(light).pos = pos;
+	for (size_t light : snapshot.lights.deletedPoints)
+		point_lights_delete(light);
+	for (size_t light : snapshot.lights.deletedSpots)
+		spot_lights_delete(light);
+	for (auto& [node, local] : snapshot.transforms.nodeLocals)
+		transformHierarchy.set_local(node, local);
+	for (auto& [surface, transform] : snapshot.transforms.surfaces)
+		set_surface_transform(surface, transform);
+}
 
 void Core::dir_lights_setup(size_t) {}
 void Core::dir_lights_cleanup(size_t) {}
+void Core::point_lights_setup(size_t) {}
+void Core::point_lights_cleanup(size_t) {}
+void Core::spot_lights_setup(size_t) {}
+void Core::spot_lights_cleanup(size_t) {}
 
-Core::Core(void (*glGetProcAddr(const char*))()) {
+Core::Core(void (*glGetProcAddr(const char*))(), JobSystem& jobs) : jobs(jobs) {
 	loadGL(glGetProcAddr);
 
 	loadDebugger();
 
-	glCreateBuffers(1, &cameraBuffer);
-	glNamedBufferStorage(cameraBuffer, sizeof(Camera), nullptr, GL_DYNAMIC_STORAGE_BIT);
-	glBindBufferBase(GL_UNIFORM_BUFFER, 0, cameraBuffer);
+	frameRing.init(1 << 18);
+	meshPool.init();
+
+	// A cascade's depth range is the diameter of its sphere, well under 4 * shadowDistance at any sane field of view
+	shadowDepthFormat =
+		4 * shadowDistance / 65535 <= shadowDepthTolerance ? GL_DEPTH_COMPONENT16 : GL_DEPTH_COMPONENT32F;
 
-	glCreateBuffers(1, &dirLightBuffer);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, dirLightBuffer);
+	glCreateFramebuffers(1, &shadowFramebuffer);
 
-	glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &dirLightShadow);
-	glTextureStorage3D(dirLightShadow, 1, GL_DEPTH_COMPONENT32F, lightmapSize, lightmapSize, 8);
-	glTextureParameteri(dirLightShadow, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
-	glTextureParameteri(dirLightShadow, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	GLint colourSamples, depthSamples;
+	glGetIntegerv(GL_MAX_COLOR_TEXTURE_SAMPLES, &colourSamples);
+	glGetIntegerv(GL_MAX_DEPTH_TEXTURE_SAMPLES, &depthSamples);
+	sceneSamples = std::min({maxSceneSamples, colourSamples, depthSamples});
+
+	size_t clusterCount = clusterGrid.x * clusterGrid.y * clusterGrid.z;
+	glCreateBuffers(1, &clusterLightCounts);
+	glNamedBufferStorage(clusterLightCounts, clusterCount * sizeof(uint32_t), nullptr, 0);
+	glCreateBuffers(1, &clusterLightIndices);
+	glNamedBufferStorage(clusterLightIndices, clusterCount * maxClusterLights * sizeof(uint32_t), nullptr, 0);
 }
 
 uint Core::create_texture(int width, int height, int channels, TextureFlags flags, void* data) {
@@ -95,58 +295,470 @@ uint Core::create_texture(int width, int height, int channels, TextureFlags flag
 	return texture;
 }
 
-void Core::renderScene(Shader::Type type, RenderOrder order) {
+void Core::bind_camera(const Camera& camera) {
+	auto allocation = frameRing.push(camera);
+	glBindBufferRange(GL_UNIFORM_BUFFER, 0, allocation.buffer, allocation.offset, allocation.size);
+}
+
+// Grow a handle indexed storage buffer to fit at least count elements, keeping its contents
+static void reserve_buffer(GLuint& buffer, size_t& capacity, size_t count, size_t stride, GLuint binding) {
+	if (capacity >= count)
+		return;
+
+	size_t newCapacity = std::max<size_t>(capacity * 2, 64);
+	while (newCapacity < count)
+		newCapacity *= 2;
+
+	GLuint newBuffer;
+	glCreateBuffers(1, &newBuffer);
+	glNamedBufferStorage(newBuffer, newCapacity * stride, nullptr, GL_DYNAMIC_STORAGE_BIT);
+	if (capacity > 0)
+		glCopyNamedBufferSubData(buffer, newBuffer, 0, 0, capacity * stride);
+	glDeleteBuffers(1, &buffer);
+
+	buffer = newBuffer;
+	capacity = newCapacity;
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffer);
+}
+
+void Core::material_set_params(MaterialHandle& material, const void* data, size_t size) {
+	reserve_buffer(materialBuffer, materialBufferCapacity, materials_lookup.size(), materialBlockSize, 3);
+
+	auto staging = frameRing.allocate(size);
+	std::memcpy(staging.data, data, size);
+	glCopyNamedBufferSubData(
+		staging.buffer, materialBuffer, staging.offset, material.handle * materialBlockSize, staging.size);
+}
+
+struct _Surface {
+	mat4 model;
+	mat3x4 normalMatrix;
+	uint32_t material;
+	uint32_t _pad[3];
+};
+
+// Read by cull_draws.comp, also indexed by surface handle
+struct _SurfaceDraw {
+	vec3 boundsMin;
+	uint32_t indexCount;
+	vec3 boundsMax;
+	uint32_t firstIndex;
+	int32_t baseVertex;
+	uint32_t dynamic;
+	uint32_t _pad[2];
+};
+
+struct _DrawCommand {
+	uint32_t count;
+	uint32_t instanceCount;
+	uint32_t firstIndex;
+	int32_t baseVertex;
+	uint32_t baseInstance;
+};
+
+void Core::update_surface_buffer() {
+	reserve_buffer(surfaceBuffer, surfaceBufferCapacity, surfaces_lookup.size(), sizeof(_Surface), 2);
+	reserve_buffer(surfaceDrawBuffer, surfaceDrawBufferCapacity, surfaces_lookup.size(), sizeof(_SurfaceDraw), 9);
+	surfaceBounds.resize(surfaces_lookup.size());
+
+	if (surfaces_dirty.empty())
+		return;
+
+	std::sort(surfaces_dirty.begin(), surfaces_dirty.end());
+	surfaces_dirty.erase(std::unique(surfaces_dirty.begin(), surfaces_dirty.end()), surfaces_dirty.end());
+
+	// Stage contiguous runs of handles together, skipping handles deleted since they were marked
+	std::vector<_Surface> run;
+	std::vector<_SurfaceDraw> drawRun;
+	size_t run_start = 0;
+	auto flush = [&]() {
+		if (!run.empty()) {
+			auto staging = frameRing.push(run);
+			glCopyNamedBufferSubData(
+				staging.buffer, surfaceBuffer, staging.offset, run_start * sizeof(_Surface), staging.size);
+			staging = frameRing.push(drawRun);
+			glCopyNamedBufferSubData(
+				staging.buffer, surfaceDrawBuffer, staging.offset, run_start * sizeof(_SurfaceDraw), staging.size);
+		}
+		run.clear();
+		drawRun.clear();
+	};
+	for (size_t handle : surfaces_dirty) {
+		size_t i = surfaces_lookup[handle];
+		if (i >= surfaces_reverse.size() || surfaces_reverse[i] != handle)
+			continue;
+		if (!run.empty() && run_start + run.size() != handle)
+			flush();
+		if (run.empty())
+			run_start = handle;
+
+		Surface& surface = surfaces_dense[i];
+		const Mesh& mesh = meshes_get(surface.mesh);
+		// Without bounds the box is large enough to pass every plane, but finite so the tests can't produce NaNs
+		AABB world = {.min = vec3(-1e30f), .max = vec3(1e30f)};
+		if (mesh.bounds.min != mesh.bounds.max) {
+			world = transform_bounds(mesh.bounds, surface.transform);
+			surfaceTree.update(handle, world.min, world.max);
+			unboundedSurfaces.erase(handle);
+		} else {
+			surfaceTree.remove(handle);
+			unboundedSurfaces.insert(handle);
+		}
+		surfaceBounds.set(handle, world.min, world.max);
+		drawRun.push_back({
+			.boundsMin = world.min,
+			.indexCount = mesh.range.indexCount,
+			.boundsMax = world.max,
+			.firstIndex = mesh.range.firstIndex,
+			.baseVertex = mesh.range.baseVertex,
+			.dynamic = surface.dynamic,
+			._pad = {},
+		});
+
+		run.push_back({
+			.model = surface.transform,
+			.normalMatrix = mat3x4(transpose(inverse(mat3(surface.transform)))),
+			.material = static_cast<uint32_t>(surface.material.handle),
+			._pad = {},
+		});
+	}
+	flush();
+	surfaces_dirty.clear();
+}
+
+void Core::cull_surfaces(const FrustumPlanes& planes, std::vector<uint8_t>& visible) const {
+	surfaceTree.cull(planes, visible, jobs);
+	visible.resize(surfaces_lookup.size());
+	for (size_t handle : unboundedSurfaces)
+		visible[handle] = 1;
+}
+
+void Core::cull_surfaces(Shader::Type type, const FrustumPlanes& planes, std::vector<uint8_t>& visible) {
+	FrustumTest test(planes);
+	visible.resize(surfaces_lookup.size());
+	for (auto& shader : shaders_dense)
+		if (shader.type & type)
+			for (auto mat : shader.materials)
+				for (size_t s : materials_get(mat).surfaces)
+					visible[s] = !surfaceTree.contains(s) || surfaceTree.leaf_visible(s, test);
+}
+
+std::vector<size_t> Core::surfaces_in_box(vec3 min, vec3 max) const {
+	std::vector<size_t> result;
+	surfaceTree.box_query(min, max, [&](size_t handle) { result.push_back(handle); });
+	result.insert(result.end(), unboundedSurfaces.begin(), unboundedSurfaces.end());
+	return result;
+}
+
+std::optional<Core::PickResult> Core::pick(double x, double y) {
+	if (width == 0 || height == 0)
+		return {};
+
+	float aspect = static_cast<float>(width) / static_cast<float>(height);
+	float tanHalfFov = tan(fov / 2);
+	vec2 ndc = {2 * x / width - 1, 1 - 2 * y / height};
+	mat4 cameraWorld = inverse(cameraPos);
+	vec3 origin = vec3(cameraWorld[3]);
+	vec3 dir = normalize(mat3(cameraWorld) * vec3(ndc.x * tanHalfFov * aspect, ndc.y * tanHalfFov, -1));
+
+	std::optional<PickResult> result;
+	surfaceTree.ray_query(origin, dir, std::numeric_limits<float>::infinity(), [&](size_t handle, float) {
+		float best = result ? result->distance : std::numeric_limits<float>::infinity();
+		Surface& surface = surfaces_get(handle);
+		auto& triangles = meshes_get(surface.mesh).triangles;
+		if (!triangles)
+			return best;
+		if (!triangles->bvh) {
+			triangles->bvh = std::make_unique<TriangleBVH>(triangles->positions, triangles->indices);
+			triangles->positions = {};
+			triangles->indices = {};
+		}
+
+		// Distances along the ray carry over into mesh space, as long as the direction isn't renormalised
+		mat4 toMesh = inverse(surface.transform);
+		auto hit = triangles->bvh->intersect(vec3(toMesh * vec4(origin, 1)), vec3(toMesh * vec4(dir, 0)), best);
+		if (!hit)
+			return best;
+		result = PickResult{handle, hit->triangle, hit->barycentrics, hit->distance, origin + dir * hit->distance};
+		return hit->distance;
+	});
+	return result;
+}
+
+void Core::update_draw_lists() {
+	if (!drawListsDirty)
+		return;
+	drawListsDirty = false;
+
+	for (auto type : {Shader::Type::Depth, Shader::Type::Opaque, Shader::Type::Shadow}) {
+		auto& list = drawLists[type];
+		glDeleteBuffers(1, &list.entries);
+		glDeleteBuffers(1, &list.bucketFirsts);
+		glDeleteBuffers(1, &list.counts);
+		glDeleteBuffers(1, &list.commands);
+		glDeleteBuffers(1, &list.countsReadback);
+		if (list.countsFence)
+			glDeleteSync(list.countsFence);
+		list = {};
+
+		std::vector<uvec2> entries;
+		std::vector<uint32_t> firsts;
+		for (size_t i = 0; i < shaders_dense.size(); i++) {
+			if ((shaders_dense[i].type & type) == 0)
+				continue;
+			for (auto mat : shaders_dense[i].materials) {
+				auto& surfaces = materials_get(mat).surfaces;
+				if (surfaces.empty())
+					continue;
+				GLuint first = entries.size();
+				for (size_t s : surfaces)
+					entries.push_back({s, list.buckets.size()});
+				firsts.push_back(first);
+				list.buckets.push_back({shaders_reverse[i], mat, first, static_cast<GLuint>(surfaces.size())});
+			}
+		}
+		list.size = entries.size();
+		if (entries.empty())
+			continue;
+
+		glCreateBuffers(1, &list.entries);
+		glNamedBufferStorage(list.entries, vector_size(entries), entries.data(), 0);
+		glCreateBuffers(1, &list.bucketFirsts);
+		glNamedBufferStorage(list.bucketFirsts, vector_size(firsts), firsts.data(), 0);
+		glCreateBuffers(1, &list.counts);
+		glNamedBufferStorage(list.counts, list.buckets.size() * sizeof(uint32_t), nullptr, 0);
+		glCreateBuffers(1, &list.countsReadback);
+		glNamedBufferStorage(
+			list.countsReadback, list.buckets.size() * sizeof(uint32_t), nullptr, GL_CLIENT_STORAGE_BIT);
+		glCreateBuffers(1, &list.commands);
+		glNamedBufferStorage(list.commands, entries.size() * sizeof(_DrawCommand), nullptr, 0);
+	}
+}
+
+GLuint Core::read_back_draw_counts(DrawList& list) {
+	// Like the Hi-Z read back, the counts are never waited for
+	if (list.countsFence) {
+		if (glClientWaitSync(list.countsFence, 0, 0) == GL_TIMEOUT_EXPIRED)
+			return list.visible;
+		glDeleteSync(list.countsFence);
+		list.countsFence = nullptr;
+		std::vector<uint32_t> counts(list.buckets.size());
+		glGetNamedBufferSubData(list.countsReadback, 0, vector_size(counts), counts.data());
+		list.visible = 0;
+		for (uint32_t count : counts)
+			list.visible += count;
+	}
+	if (list.size == 0)
+		return list.visible;
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	glCopyNamedBufferSubData(list.counts, list.countsReadback, 0, 0, list.buckets.size() * sizeof(uint32_t));
+	list.countsFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	return list.visible;
+}
+
+void Core::renderSceneIndirect(
+	Shader::Type type, const FrustumPlanes& planes, uint32_t mask, const mat4* occlusionViewProj) {
+	auto& list = drawLists[type];
+	if (list.size == 0)
+		return;
+
+	// The last cull_draws.comp to use the list wrote the counts with atomics
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	uint32_t zero = 0;
+	glClearNamedBufferData(list.counts, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+	glUseProgram(cullDrawsProgram);
+	glUniform4fv(0, planes.size(), &planes[0].x);
+	glUniform1ui(6, mask);
+	glUniform1ui(7, occlusionViewProj != nullptr);
+	if (occlusionViewProj) {
+		glUniformMatrix4fv(8, 1, false, value_ptr(*occlusionViewProj));
+		glBindTextures(hizTextureUnit, 1, &hiz);
+	}
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, list.entries);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, list.bucketFirsts);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, list.counts);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 13, list.commands);
+	glDispatchCompute((list.size + 63) / 64, 1, 1);
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+
+	glBindVertexArray(meshPool.vao());
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, list.commands);
+	glBindBuffer(GL_PARAMETER_BUFFER, list.counts);
+	GLuint boundProgram = 0;
+	for (size_t i = 0; i < list.buckets.size(); i++) {
+		auto& bucket = list.buckets[i];
+		GLuint program = shaders_get(bucket.shader).shader;
+		if (program != boundProgram)
+			glUseProgram(program);
+		boundProgram = program;
+		// Texture sets are looked up each time, they can be swapped without the material being set up again
+		for (auto& shader_pass : materials_get(bucket.material).shader_passes) {
+			if (shader_pass.shader.handle != bucket.shader)
+				continue;
+			auto& textures = texture_sets[shader_pass.textures];
+			glBindTextures(materialTextureUnit, textures.size(), textures.data());
+			break;
+		}
+		glMultiDrawElementsIndirectCount(
+			GL_TRIANGLES, GL_UNSIGNED_INT, reinterpret_cast<const void*>(bucket.first * sizeof(_DrawCommand)),
+			i * sizeof(uint32_t), bucket.size, sizeof(_DrawCommand));
+	}
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	glBindBuffer(GL_PARAMETER_BUFFER, 0);
+}
+
+void Core::draw_mesh(const Mesh& mesh, GLsizei instances, GLuint baseInstance) {
+	glDrawElementsInstancedBaseVertexBaseInstance(
+		GL_TRIANGLES, mesh.range.indexCount, GL_UNSIGNED_INT,
+		reinterpret_cast<const void*>(mesh.range.firstIndex * sizeof(uint32_t)), instances, mesh.range.baseVertex,
+		baseInstance);
+}
+
+void Core::renderScene(
+	Shader::Type type, RenderOrder order, GLsizei instances, const std::vector<uint8_t>* visible) {
+	// Skip state changes that would rebind what is already bound
+	GLuint boundProgram = 0;
+	size_t boundTextures = std::numeric_limits<size_t>::max();
+	auto use_program = [&](GLuint program) {
+		if (program != boundProgram)
+			glUseProgram(program);
+		boundProgram = program;
+	};
+	auto bind_textures = [&](size_t set) {
+		if (set != boundTextures) {
+			auto& textures = texture_sets[set];
+			glBindTextures(materialTextureUnit, textures.size(), textures.data());
+		}
+		boundTextures = set;
+	};
+
+	glBindVertexArray(meshPool.vao());
 	if (order == RenderOrder::Shader) {
 		for (auto& shader : shaders_dense) {
 			if ((shader.type & type) == 0)
 				continue;
 
-			glUseProgram(shader.shader);
+			use_program(shader.shader);
 			for (auto mat : shader.materials) {
 				auto& material = materials_get(mat);
 
 				for (auto shader_pass : material.shader_passes) {
 					if (&shaders_get(shader_pass.shader) != &shader)
 						continue;
-					glBindBufferBase(GL_UNIFORM_BUFFER, 1, shader_pass.uniform);
-					glBindTextures(3, shader_pass.textures.size(), shader_pass.textures.data());
+					bind_textures(shader_pass.textures);
 					break;
 				}
 
 				for (auto& s : material.surfaces) {
+					if (visible && !(*visible)[s])
+						continue;
 					auto& surface = surfaces_get(s);
-					auto& mesh = meshes_get(surface.mesh);
-					glBindVertexArray(mesh.vao);
-
-					glUniformMatrix4fv(0, 1, false, value_ptr(surface.transform));
-
-					glDrawElements(GL_TRIANGLES, mesh.count, GL_UNSIGNED_INT, 0);
+					draw_mesh(meshes_get(surface.mesh), instances, s);
 				}
 			}
 		}
 	} else {
-		std::vector<Surface> surfaces = surfaces_dense;
-		for (auto& surface : surfaces) {
+		// Only the surfaces with a pass of the type, in storage order
+		std::vector<size_t> handles;
+		for (auto& shader : shaders_dense)
+			if (shader.type & type)
+				for (auto mat : shader.materials)
+					for (size_t s : materials_get(mat).surfaces)
+						if (!visible || (*visible)[s])
+							handles.push_back(s);
+		std::sort(handles.begin(), handles.end(), [&](size_t a, size_t b) {
+			return surfaces_lookup[a] < surfaces_lookup[b];
+		});
+		handles.erase(std::unique(handles.begin(), handles.end()), handles.end());
+		for (size_t handle : handles) {
+			auto& surface = surfaces_get(handle);
 			auto& mesh = meshes_get(surface.mesh);
-			glBindVertexArray(mesh.vao);
 			for (auto& shader_pass : materials_get(surface.material).shader_passes) {
 				auto& shader = shaders_get(shader_pass.shader);
 				if ((shader.type & type) == 0)
 					continue;
 
-				glUseProgram(shader.shader);
+				use_program(shader.shader);
+				bind_textures(shader_pass.textures);
 
-				glBindBufferBase(GL_UNIFORM_BUFFER, 1, shader_pass.uniform);
-				glBindTextures(3, shader_pass.textures.size(), shader_pass.textures.data());
-
-				glUniformMatrix4fv(0, 1, false, value_ptr(surface.transform));
-
-				glDrawElements(GL_TRIANGLES, mesh.count, GL_UNSIGNED_INT, 0);
+				draw_mesh(mesh, instances, handle);
 			}
 		}
 	}
 }
 
+void Core::create_scene_targets() {
+	if (sceneFramebuffer) {
+		glDeleteFramebuffers(1, &sceneFramebuffer);
+		GLuint textures[] = {sceneColour, sceneDepth, hiz};
+		glDeleteTextures(3, textures);
+	}
+	// A minimised window still gets targets, just useless ones
+	sceneSize = max(ivec2(width, height), ivec2(1));
+
+	glCreateTextures(GL_TEXTURE_2D_MULTISAMPLE, 1, &sceneColour);
+	glTextureStorage2DMultisample(sceneColour, sceneSamples, GL_SRGB8_ALPHA8, sceneSize.x, sceneSize.y, GL_TRUE);
+	glCreateTextures(GL_TEXTURE_2D_MULTISAMPLE, 1, &sceneDepth);
+	glTextureStorage2DMultisample(sceneDepth, sceneSamples, GL_DEPTH_COMPONENT32F, sceneSize.x, sceneSize.y, GL_TRUE);
+	glCreateFramebuffers(1, &sceneFramebuffer);
+	glNamedFramebufferTexture(sceneFramebuffer, GL_COLOR_ATTACHMENT0, sceneColour, 0);
+	glNamedFramebufferTexture(sceneFramebuffer, GL_DEPTH_ATTACHMENT, sceneDepth, 0);
+
+	// Every level down to 1x1, level n is sceneSize / 2^n rounded down
+	hizLevels = std::bit_width(static_cast<unsigned>(std::max(sceneSize.x, sceneSize.y)));
+	glCreateTextures(GL_TEXTURE_2D, 1, &hiz);
+	glTextureStorage2D(hiz, hizLevels, GL_R32F, sceneSize.x, sceneSize.y);
+}
+
+void Core::build_hiz() {
+	glUseProgram(hizInitProgram);
+	glBindTextures(0, 1, &sceneDepth);
+	glBindImageTexture(0, hiz, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+	glDispatchCompute((sceneSize.x + 7) / 8, (sceneSize.y + 7) / 8, 1);
+
+	glUseProgram(hizDownsampleProgram);
+	glBindTextures(0, 1, &hiz);
+	for (int level = 1; level < hizLevels; level++) {
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+		ivec2 size = max(sceneSize / (1 << level), ivec2(1));
+		glUniform1i(0, level);
+		glBindImageTexture(0, hiz, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		glDispatchCompute((size.x + 7) / 8, (size.y + 7) / 8, 1);
+	}
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+}
+
+void Core::read_back_hiz(const mat4& viewProj) {
+	// The last read back becomes the occluders once the GPU has finished it, it is never waited for
+	if (hizReadback.fence) {
+		if (glClientWaitSync(hizReadback.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+			return;
+		glDeleteSync(hizReadback.fence);
+		hizReadback.fence = nullptr;
+		std::vector<float> depth(hizReadback.size.x * hizReadback.size.y);
+		glGetNamedBufferSubData(hizReadback.buffer, 0, vector_size(depth), depth.data());
+		occluders.build(hizReadback.viewProj, hizReadback.size.x, hizReadback.size.y, std::move(depth));
+	}
+
+	int level = 0;
+	while (level + 1 < hizLevels && sceneSize.x / (1 << level) > hizReadbackWidth)
+		level++;
+	ivec2 size = max(sceneSize / (1 << level), ivec2(1));
+	size_t bytes = static_cast<size_t>(size.x) * size.y * sizeof(float);
+	if (hizReadback.capacity < bytes) {
+		glDeleteBuffers(1, &hizReadback.buffer);
+		glCreateBuffers(1, &hizReadback.buffer);
+		glNamedBufferStorage(hizReadback.buffer, bytes, nullptr, GL_CLIENT_STORAGE_BIT);
+		hizReadback.capacity = bytes;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, hizReadback.buffer);
+	glGetTextureImage(hiz, level, GL_RED, GL_FLOAT, bytes, nullptr);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	hizReadback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	hizReadback.viewProj = viewProj;
+	hizReadback.size = size;
+}
+
 void Core::run() {
 	glEnable(GL_FRAMEBUFFER_SRGB);
 	glEnable(GL_DEPTH_TEST);
@@ -156,67 +768,374 @@ void Core::run() {
 	glDisable(GL_BLEND);
 	glDepthFunc(GL_LESS);
 
+	size_t transformsUpdated = update_transforms();
+	update_surface_buffer();
+	surfaceTree.rebuild_if_degraded();
+	if (cullingMode == CullingMode::GPU)
+		update_draw_lists();
+
 	struct _DirLight {
 		vec3 dir;
 		float _pad0;
 		vec3 colour;
 		float _pad1;
-		mat4 shadowMapTrans;
+		mat4 shadowMapTrans[shadowCascades];
+		vec4 shadowTiles[shadowCascades];
 	};
 
-	static const mat4 dirLightProj = ortho(
-		-lightmapCoverage, lightmapCoverage, -lightmapCoverage, lightmapCoverage, -lightmapCoverage, lightmapCoverage);
-	std::vector<_DirLight> dirLights;
-	dirLights.resize(dir_lights_dense.size());
-	std::transform(dir_lights_dense.begin(), dir_lights_dense.end(), dirLights.begin(), [](DirLight& dirlight) {
-		return _DirLight{
-			.dir = dirlight.dir,
-			.colour = dirlight.colour,
-			.shadowMapTrans = dirLightProj * lookAt(vec3{0, 0, 0}, -dirlight.dir, vec3{0, 1, 0}),
-		};
-	});
+	float aspect = static_cast<float>(width) / static_cast<float>(height);
+	mat4 cameraWorld = inverse(cameraPos);
+
+	// Practical split scheme: blend logarithmic and uniform splits between the near plane and shadowDistance
+	const float zNear = 0.1f;
+	std::array<float, shadowCascades + 1> splits;
+	for (int c = 0; c <= shadowCascades; c++) {
+		float t = static_cast<float>(c) / shadowCascades;
+		float logSplit = zNear * pow(shadowDistance / zNear, t);
+		float uniformSplit = zNear + (shadowDistance - zNear) * t;
+		splits[c] = mix(uniformSplit, logSplit, cascadeSplitLambda);
+	}
+
+	// Each cascade is a sphere around its slice of the view frustum, so its size doesn't change as the camera turns
+	struct CascadeSphere {
+		vec3 centre;
+		float radius;
+	};
+	std::array<CascadeSphere, shadowCascades> spheres;
+	float tanHalfFov = tan(fov / 2);
+	for (int c = 0; c < shadowCascades; c++) {
+		std::array<vec3, 8> corners;
+		for (int i = 0; i < 8; i++) {
+			float depth = splits[c + (i >> 2)];
+			vec3 corner = {
+				depth * tanHalfFov * aspect * ((i & 1) ? 1 : -1), depth * tanHalfFov * ((i & 2) ? 1 : -1), -depth};
+			corners[i] = vec3(cameraWorld * vec4(corner, 1));
+		}
+		vec3 centre(0);
+		for (auto& corner : corners)
+			centre += corner / 8.0f;
+		float radius = 0;
+		for (auto& corner : corners)
+			radius = max(radius, length(corner - centre));
+		// Quantised so floating point noise can't change the texel size from frame to frame
+		spheres[c] = {centre, ceil(radius * 16) / 16};
+	}
+
+	// Tiles are resized in place as lights change brightness, the atlas is only repacked when that fails, or when it
+	// has become much larger than its tiles
+	float maxLuminance = 0;
+	for (auto& dirLight : dir_lights_dense)
+		maxLuminance = max(maxLuminance, luminance(dirLight.colour));
+	std::vector<int> tileSizes(dir_lights_dense.size() * shadowCascades);
+	size_t tileArea = 0;
+	for (size_t i = 0; i < tileSizes.size(); i++) {
+		tileSizes[i] = shadow_tile_size(dir_lights_dense[i / shadowCascades].colour, maxLuminance);
+		tileArea += static_cast<size_t>(tileSizes[i]) * tileSizes[i];
+	}
+	for (size_t i = tileSizes.size(); i < shadowCache.size(); i++)
+		if (shadowCache[i].tile)
+			shadowAtlas.release(*shadowCache[i].tile);
+	shadowCache.resize(tileSizes.size());
+	bool repack = static_cast<size_t>(shadowAtlas.size()) * shadowAtlas.size() > 4 * tileArea;
+	for (size_t i = 0; i < tileSizes.size() && !repack; i++) {
+		auto& cache = shadowCache[i];
+		if (cache.requestedSize == tileSizes[i])
+			continue;
+		if (cache.tile)
+			shadowAtlas.release(*cache.tile);
+		cache.requestedSize = tileSizes[i];
+		cache.tile = shadowAtlas.allocate(tileSizes[i]);
+		cache.valid = false;
+		repack = !cache.tile;
+	}
+	if (repack)
+		pack_shadow_atlas(tileSizes);
+	int atlasSize = shadowAtlas.size();
+
+	std::vector<_DirLight> dirLights(dir_lights_dense.size());
+	// Cascade matrices into clip space, for drawing the tiles; the ones uploaded map into the atlas instead
+	std::vector<mat4> cascadeTrans(shadowCache.size());
+	for (size_t i = 0; i < dirLights.size(); i++) {
+		auto& dirLight = dir_lights_dense[i];
+		dirLights[i].dir = dirLight.dir;
+		dirLights[i].colour = dirLight.colour;
+
+		vec3 up = abs(dirLight.dir.y) > 0.99f ? vec3{0, 0, 1} : vec3{0, 1, 0};
+		mat4 lightView = lookAt(vec3{0, 0, 0}, -dirLight.dir, up);
+		for (int c = 0; c < shadowCascades; c++) {
+			size_t k = i * shadowCascades + c;
+			auto& tile = shadowCache[k].tile;
+			if (!tile) {
+				dirLights[i].shadowMapTrans[c] = mat4(1.0f);
+				dirLights[i].shadowTiles[c] = vec4(0);
+				continue;
+			}
+
+			float radius = spheres[c].radius;
+			vec3 centre = vec3(lightView * vec4(spheres[c].centre, 1));
+			// Move the cascade in whole texels so shadow edges don't shimmer as the camera moves
+			float texel = 2 * radius / tile->size;
+			centre.x = floor(centre.x / texel) * texel;
+			centre.y = floor(centre.y / texel) * texel;
+			// Casters between the light and the near plane are flattened onto it by depth clamping
+			cascadeTrans[k] = ortho(
+								  centre.x - radius, centre.x + radius, centre.y - radius, centre.y + radius,
+								  -centre.z - radius, -centre.z + radius) *
+				lightView;
+
+			float scale = static_cast<float>(tile->size) / atlasSize;
+			vec2 offset = vec2(tile->x, tile->y) / static_cast<float>(atlasSize);
+			mat4 toTile = glm::scale(
+				translate(mat4(1.0f), vec3(offset + scale / 2, 0.5f)), vec3(scale / 2, scale / 2, 0.5f));
+			dirLights[i].shadowMapTrans[c] = toTile * cascadeTrans[k];
+			// Inset by half a texel so filtering never reads a neighbouring tile
+			float halfTexel = 0.5f / atlasSize;
+			dirLights[i].shadowTiles[c] = vec4(offset + halfTexel, offset + scale - halfTexel);
+		}
+	}
+
+	{
+		// The light count is stored in a header so that no lights still binds a non-empty range
+		const size_t header = 16;
+		auto allocation = frameRing.allocate(header + vector_size(dirLights));
+		*static_cast<uint32_t*>(allocation.data) = dirLights.size();
+		std::copy(
+			dirLights.begin(), dirLights.end(),
+			reinterpret_cast<_DirLight*>(static_cast<uint8_t*>(allocation.data) + header));
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 1, allocation.buffer, allocation.offset, allocation.size);
+	}
 
-	glNamedBufferData(dirLightBuffer, vector_size(dirLights), dirLights.data(), GL_DYNAMIC_DRAW);
+	frameStats = {};
+	frameStats.shadowAtlasSize = atlasSize;
+	frameStats.bvhNodes = surfaceTree.node_count();
+	frameStats.transformNodes = transformHierarchy.size();
+	frameStats.transformsUpdated = transformsUpdated;
+	frameStats.shadowAtlasBytes = static_cast<size_t>(atlasSize) * atlasSize *
+		(shadowDepthFormat == GL_DEPTH_COMPONENT16 ? 2 : 4) * (dirLightShadowStatic ? 2 : 1);
 
-	GLuint framebuffer;
-	glCreateFramebuffers(1, &framebuffer);
-	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	gpuTimers.begin("Shadows");
+	// On the GPU path casters are only counted on the GPU, any dynamic surface may be in a cascade
+	bool gpu = cullingMode == CullingMode::GPU;
+	std::vector<uint8_t> casters, staticCasters, dynamicCasters;
+	if (!gpu) {
+		staticCasters.resize(surfaces_lookup.size());
+		dynamicCasters.resize(surfaces_lookup.size());
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, shadowFramebuffer);
+	glEnable(GL_SCISSOR_TEST);
+	glCullFace(GL_FRONT);
 	for (size_t i = 0; i < dirLights.size(); i++) {
-		glNamedFramebufferTextureLayer(framebuffer, GL_DEPTH_ATTACHMENT, dirLightShadow, 0, i);
+		for (int c = 0; c < shadowCascades; c++) {
+			auto& cache = shadowCache[i * shadowCascades + c];
+			mat4& shadowMapTrans = cascadeTrans[i * shadowCascades + c];
+			if (!cache.tile)
+				continue;
+			auto& tile = *cache.tile;
 
-		Camera cam = {.proj = mat4(1.0f), .view = dirLights[i].shadowMapTrans, .camPos = dirLights[i].dir};
-		glNamedBufferSubData(cameraBuffer, 0, sizeof(Camera), &cam);
+			// Surfaces outside the cascade's box can't cast into it, except from the light's side of the near plane
+			auto in_cascade = [&](const AABB& worldBounds) {
+				AABB bounds = transform_bounds(worldBounds, shadowMapTrans);
+				return bounds.max.x >= -1 && bounds.min.x <= 1 && bounds.max.y >= -1 && bounds.min.y <= 1 &&
+					bounds.min.z <= 1;
+			};
+
+			// The cascade moves with the camera and light, so a cached map is only reusable while its matrix is
+			bool staticDirty = !cache.valid || cache.shadowMapTrans != shadowMapTrans;
+			for (size_t j = 0; j < shadowDirtyBounds.size() && !staticDirty; j++)
+				staticDirty = in_cascade(shadowDirtyBounds[j]);
+
+			auto planes = frustum_planes(shadowMapTrans, false);
+			if (!gpu)
+				cull_surfaces(planes, casters);
+			size_t staticCount = 0, dynamicCount = gpu ? dynamicSurfaces : 0;
+			for (size_t j = 0; j < surfaces_dense.size() && !gpu; j++) {
+				size_t handle = surfaces_reverse[j];
+				bool cast = casters[handle];
+				bool dynamic = surfaces_dense[j].dynamic;
+				staticCasters[handle] = cast && !dynamic;
+				dynamicCasters[handle] = cast && dynamic;
+				staticCount += cast && !dynamic;
+				dynamicCount += cast && dynamic;
+			}
 
-		glViewport(0, 0, lightmapSize, lightmapSize);
-		glClear(GL_DEPTH_BUFFER_BIT);
-		glCullFace(GL_FRONT);
-		renderScene(Shader::Type::Shadow);
+			if (!staticDirty && dynamicCount == 0 && !cache.hadDynamic) {
+				frameStats.shadowCascadesCached++;
+				continue;
+			}
+
+			bind_camera({.proj = mat4(1.0f), .view = shadowMapTrans, .camPos = dirLights[i].dir});
+			glViewport(tile.x, tile.y, tile.size, tile.size);
+			glScissor(tile.x, tile.y, tile.size, tile.size);
+			if (staticDirty) {
+				GLuint target = dirLightShadowStatic ? dirLightShadowStatic : dirLightShadow;
+				glNamedFramebufferTexture(shadowFramebuffer, GL_DEPTH_ATTACHMENT, target, 0);
+				glClear(GL_DEPTH_BUFFER_BIT);
+				if (gpu)
+					renderSceneIndirect(Shader::Type::Shadow, planes, 1);
+				else
+					renderScene(Shader::Type::Shadow, RenderOrder::Shader, 1, &staticCasters);
+				cache.valid = true;
+				cache.shadowMapTrans = shadowMapTrans;
+				if (!gpu) {
+					frameStats.shadowDraws += staticCount;
+					frameStats.shadowCulled += surfaces_dense.size() - staticCount - dynamicCount;
+				}
+			}
+			if (dirLightShadowStatic) {
+				glCopyImageSubData(
+					dirLightShadowStatic, GL_TEXTURE_2D, 0, tile.x, tile.y, 0, dirLightShadow, GL_TEXTURE_2D, 0, tile.x,
+					tile.y, 0, tile.size, tile.size, 1);
+				glNamedFramebufferTexture(shadowFramebuffer, GL_DEPTH_ATTACHMENT, dirLightShadow, 0);
+				if (gpu) {
+					renderSceneIndirect(Shader::Type::Shadow, planes, 2);
+				} else {
+					renderScene(Shader::Type::Shadow, RenderOrder::Shader, 1, &dynamicCasters);
+					frameStats.shadowDraws += dynamicCount;
+				}
+			}
+			cache.hadDynamic = dynamicCount > 0;
+		}
 	}
+	glDisable(GL_SCISSOR_TEST);
+	shadowDirtyBounds.clear();
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glDeleteFramebuffers(1, &framebuffer);
+	gpuTimers.end();
 
-	Camera cam = {
-		.proj = infinitePerspective(fov, static_cast<float>(width) / static_cast<float>(height), 0.1f),
+	bind_camera({
+		.proj = infinitePerspective(fov, aspect, zNear),
 		.view = cameraPos,
-		.camPos = vec3(inverse(cameraPos) * vec4{0, 0, 0, 1})};
-	glNamedBufferSubData(cameraBuffer, 0, sizeof(Camera), &cam);
+		.camPos = vec3(inverse(cameraPos) * vec4{0, 0, 0, 1})});
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	gpuTimers.begin("Light clusters");
+	{
+		struct _ClusterHeader {
+			vec2 tileScale;
+			float sliceScale;
+			float sliceBias;
+			uint32_t lightCount;
+			uint32_t _pad[3];
+		};
+		// Point lights are spot lights whose cone never cuts off
+		struct _LocalLight {
+			vec3 pos;
+			float range;
+			vec3 colour;
+			float spotScale;
+			vec3 dir;
+			float spotOffset;
+		};
+		std::vector<_LocalLight> localLights;
+		localLights.reserve(point_lights_dense.size() + spot_lights_dense.size());
+		for (auto& light : point_lights_dense)
+			localLights.push_back({light.pos, light.range, light.colour, 0, vec3(0), 1});
+		for (auto& light : spot_lights_dense) {
+			float cosInner = cos(light.innerAngle), cosOuter = cos(light.outerAngle);
+			float spotScale = 1 / max(cosInner - cosOuter, 1e-4f);
+			localLights.push_back({light.pos, light.range, light.colour, spotScale, light.dir, -cosOuter * spotScale});
+		}
+		frameStats.localLights = localLights.size();
+
+		// Slice s starts at zNear * (clusterDepth / zNear)^(s / clusterGrid.z)
+		float sliceScale = clusterGrid.z / log(clusterDepth / zNear);
+		_ClusterHeader header = {
+			.tileScale = vec2(clusterGrid) / vec2(width, height),
+			.sliceScale = sliceScale,
+			.sliceBias = log(zNear) * sliceScale,
+			.lightCount = static_cast<uint32_t>(localLights.size()),
+			._pad = {}};
+		auto allocation = frameRing.allocate(sizeof(header) + vector_size(localLights));
+		std::memcpy(allocation.data, &header, sizeof(header));
+		std::copy(
+			localLights.begin(), localLights.end(),
+			reinterpret_cast<_LocalLight*>(static_cast<uint8_t*>(allocation.data) + sizeof(header)));
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 6, allocation.buffer, allocation.offset, allocation.size);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, clusterLightCounts);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, clusterLightIndices);
+
+		glUseProgram(lightClusterProgram);
+		glDispatchCompute((clusterGrid.x * clusterGrid.y * clusterGrid.z + 63) / 64, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+	gpuTimers.end();
+
+	if (sceneSize != max(ivec2(width, height), ivec2(1)))
+		create_scene_targets();
+	glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer);
 	glViewport(0, 0, width, height);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+	mat4 viewProj = infinitePerspective(fov, aspect, zNear) * cameraPos;
+	auto cameraPlanes = frustum_planes(viewProj);
+	frameStats.gpuCulling = cullingMode == CullingMode::GPU;
+	// The GPU path leaves the CPU only the transparent surfaces, and takes the stats from its opaque draw counts
+	std::vector<uint8_t> visible;
+	if (cullingMode == CullingMode::GPU) {
+		cull_surfaces(Shader::Type::Transparent, cameraPlanes, transparentVisible);
+	} else {
+		cull_surfaces(cameraPlanes, visible);
+		for (size_t handle : surfaces_reverse)
+			frameStats.surfacesVisible += visible[handle];
+		frameStats.surfacesCulled = surfaces_dense.size() - frameStats.surfacesVisible;
+	}
+
+	// Stale occluders can't vouch for surfaces that have moved since
+	if (cullingMode == CullingMode::CPU && occlusionCulling && !occluders.empty()) {
+		std::vector<uint8_t> inFrustum = visible;
+		surfaceBounds.occlusion_cull(occluders, visible, jobs);
+		for (size_t j = 0; j < surfaces_dense.size(); j++) {
+			size_t handle = surfaces_reverse[j];
+			if (surfaces_dense[j].dynamic)
+				visible[handle] = inFrustum[handle];
+			frameStats.surfacesOccluded += inFrustum[handle] && !visible[handle];
+		}
+	}
+
 	glCullFace(GL_BACK);
-	renderScene(Shader::Type::Depth);
+	gpuTimers.begin("Depth");
+	if (cullingMode == CullingMode::GPU)
+		renderSceneIndirect(Shader::Type::Depth, cameraPlanes);
+	else
+		renderScene(Shader::Type::Depth, RenderOrder::Shader, 1, &visible);
+	gpuTimers.end();
+
+	if (occlusionCulling) {
+		gpuTimers.begin("Hi-Z");
+		build_hiz();
+		read_back_hiz(viewProj);
+		gpuTimers.end();
+	}
 
 	glDepthFunc(GL_EQUAL);
 	glBindTextures(0, 1, &dirLightShadow);
-	renderScene(Shader::Type::Opaque);
+	glBindTextures(sceneTextureUnit, scene_textures.size(), scene_textures.data());
+	gpuTimers.begin("Opaque");
+	if (cullingMode == CullingMode::GPU) {
+		renderSceneIndirect(Shader::Type::Opaque, cameraPlanes, 3, occlusionCulling ? &viewProj : nullptr);
+		auto& opaque = drawLists[Shader::Type::Opaque];
+		frameStats.surfacesVisible = read_back_draw_counts(opaque);
+		frameStats.surfacesCulled = opaque.size - std::min(frameStats.surfacesVisible, size_t(opaque.size));
+	} else
+		renderScene(Shader::Type::Opaque, RenderOrder::Shader, 1, &visible);
+	gpuTimers.end();
 
 	glDepthFunc(GL_LESS);
 	glEnable(GL_BLEND);
 	glBlendEquationSeparate(GL_FUNC_ADD, GL_FUNC_ADD);
 	glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ZERO);
-	renderScene(Shader::Type::Transparent, RenderOrder::Distance);
+	gpuTimers.begin("Transparent");
+	renderScene(
+		Shader::Type::Transparent, RenderOrder::Distance, 1,
+		cullingMode == CullingMode::GPU ? &transparentVisible : &visible);
+	gpuTimers.end();
+
+	glBlitNamedFramebuffer(
+		sceneFramebuffer, 0, 0, 0, sceneSize.x, sceneSize.y, 0, 0, sceneSize.x, sceneSize.y, GL_COLOR_BUFFER_BIT,
+		GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	gpuTimers.end_frame();
+	frameRing.end_frame();
 }
 
 } // namespace Render
\ No newline at end of file
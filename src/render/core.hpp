@@ -1,12 +1,28 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <glm/gtc/constants.hpp>
 #include <glm/gtc/integer.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
+#include "bvh.hpp"
+#include "culling.hpp"
+#include "frame_ring.hpp"
+#include "gpu_timers.hpp"
+#include "job_system.hpp"
+#include "mesh_pool.hpp"
+#include "shadow_atlas.hpp"
+#include "transform_hierarchy.hpp"
+#include "triangle_bvh.hpp"
+
 namespace Render {
 
 using namespace glm;
@@ -128,6 +144,7 @@ using namespace glm;
 			src.handle = std::numeric_limits<size_t>::max();                                                           \
 			return *this;                                                                                              \
 		}                                                                                                              \
+		size_t id() const { return handle; }                                                                           \
 	};                                                                                                                 \
                                                                                                                        \
   protected:                                                                                                           \
@@ -137,22 +154,45 @@ using namespace glm;
 
 typedef uint TextureHandle;
 
+struct SceneSnapshot;
+
 class Core {
 	// GL typecasts
   protected:
 	typedef int GLsizei;
+	typedef unsigned int GLenum;
 	typedef unsigned int GLuint;
 	typedef signed long int GLsizeiptr;
 
+  protected:
+	JobSystem& jobs;
+
 	// Begin Resources
 
   protected:
+	struct AABB {
+		vec3 min = vec3(0);
+		vec3 max = vec3(0);
+	};
+	static AABB transform_bounds(const AABB& bounds, const mat4& transform);
+
+	MeshPool meshPool;
+	// A CPU copy of a mesh's triangles for picking. The BVH is built from it by the first pick to reach the mesh,
+	// which then frees the copy
+	struct MeshTriangles {
+		std::vector<vec3> positions;
+		std::vector<uint32_t> indices;
+		std::unique_ptr<TriangleBVH> bvh;
+	};
 	struct Mesh {
-		GLuint vao;
-		GLsizei count;
-		std::vector<GLuint> buffers;
+		MeshPool::Range range;
+		// Meshes without bounds, such as the skybox cube, are never culled or picked
+		AABB bounds = {};
+		std::shared_ptr<MeshTriangles> triangles = {};
 	};
 	RESOURCE_CONTAINER(Mesh, meshes, Core)
+	// vertices are in MeshPool's layout
+	MeshHandle mesh_create(const std::vector<float>& vertices, const std::vector<uint32_t>& indices, AABB bounds);
 
   protected:
 	struct Shader {
@@ -170,14 +210,35 @@ class Core {
 	struct Material {
 		struct ShaderPass {
 			ShaderHandle shader;
-			GLuint uniform;
-			std::vector<TextureHandle> textures;
+			size_t textures = 0;
 		};
 		std::vector<ShaderPass> shader_passes;
 		std::unordered_set<size_t> surfaces = {};
 	};
 	RESOURCE_CONTAINER(Material, materials, Core)
 
+  protected:
+	// Material parameter blocks are packed into one buffer, indexed by material handle
+	static const size_t materialBlockSize = 64;
+	GLuint materialBuffer = 0;
+	size_t materialBufferCapacity = 0;
+	void material_set_params(MaterialHandle& material, const void* data, size_t size);
+	template <class T> void material_set_params(MaterialHandle& material, const T& params) {
+		static_assert(sizeof(T) <= materialBlockSize);
+		material_set_params(material, &params, sizeof(T));
+	}
+	void material_set_shader_passes(MaterialHandle& material, std::vector<Material::ShaderPass> shader_passes);
+
+	// Texture sets are interned, so draws that share textures can skip rebinding them
+	static const int materialTextureUnit = 6;
+	std::vector<std::vector<TextureHandle>> texture_sets = {{}};
+	std::map<std::vector<TextureHandle>, size_t> texture_set_lookup = {{{}, 0}};
+	size_t texture_set(const std::vector<TextureHandle>& textures);
+
+	// Textures shared by every material, bound once per frame
+	static const int sceneTextureUnit = 3;
+	std::vector<TextureHandle> scene_textures;
+
 	// End Resources
 
 	// Begin Instances
@@ -187,6 +248,10 @@ class Core {
 		MeshHandle mesh;
 		MaterialHandle material;
 		mat4 transform;
+		// Dynamic surfaces are redrawn into the shadow maps every frame, static ones only when something changes
+		bool dynamic = false;
+		// Transform node the surface follows, if any
+		size_t node = std::numeric_limits<size_t>::max();
 	};
 	INSTANCE_CONTAINER(Surface, surfaces, Core)
 
@@ -196,20 +261,114 @@ class Core {
 	}
 
 	MeshHandle surface_get_mesh(SurfaceHandle& surface) { return surfaces_get(surface).mesh; }
-	void surface_set_mesh(SurfaceHandle& surface, MeshHandle& mesh) { surfaces_get(surface).mesh = mesh; }
+	void surface_set_mesh(SurfaceHandle& surface, MeshHandle& mesh) {
+		invalidate_shadows(surfaces_get(surface));
+		surfaces_get(surface).mesh = mesh;
+		surfaces_dirty.push_back(surface.handle);
+		invalidate_shadows(surfaces_get(surface));
+	}
 
 	MaterialHandle surface_get_material(SurfaceHandle& surface) { return surfaces_get(surface).material; }
 	void surface_set_material(SurfaceHandle& surface, MaterialHandle& material) {
 		materials_get(surfaces_get(surface).material).surfaces.erase(surface.handle);
 		surfaces_get(surface).material = material;
 		materials_get(material).surfaces.emplace(surface.handle);
+		surfaces_dirty.push_back(surface.handle);
+		drawListsDirty = true;
+		invalidate_shadows(surfaces_get(surface));
 	}
 
 	mat4 surface_get_transform(SurfaceHandle& surface) { return surfaces_get(surface).transform; }
-	void surface_set_transform(SurfaceHandle& surface, mat4 transform) { surfaces_get(surface).transform = transform; }
+	// Surfaces following a node have this replaced whenever the node moves
+	void surface_set_transform(SurfaceHandle& surface, mat4 transform) {
+		set_surface_transform(surface.handle, transform);
+	}
+
+	bool surface_get_dynamic(SurfaceHandle& surface) { return surfaces_get(surface).dynamic; }
+	void surface_set_dynamic(SurfaceHandle& surface, bool dynamic);
 
 	void surface_delete(SurfaceHandle surface) { surfaces_delete(std::move(surface)); }
 
+  protected:
+	void set_surface_transform(size_t handle, mat4 transform) {
+		invalidate_shadows(surfaces_get(handle));
+		surfaces_get(handle).transform = transform;
+		surfaces_dirty.push_back(handle);
+		invalidate_shadows(surfaces_get(handle));
+	}
+
+	// World bounds of static casters that changed since the shadow maps were last updated
+	std::vector<AABB> shadowDirtyBounds;
+	void invalidate_shadows(Surface& surface) {
+		if (!surface.dynamic)
+			shadowDirtyBounds.push_back(transform_bounds(meshes_get(surface.mesh).bounds, surface.transform));
+	}
+
+	// Per surface data on the GPU, indexed by surface handle through gl_BaseInstance. World bounds for culling are
+	// updated alongside it, also by surface handle: flat for the occlusion tests, and in surfaceTree for frustum
+	// culling and queries. Surfaces whose meshes have no bounds stay out of the tree and are never culled
+	GLuint surfaceBuffer = 0;
+	size_t surfaceBufferCapacity = 0;
+	std::vector<size_t> surfaces_dirty;
+	OcclusionBounds surfaceBounds;
+	SurfaceBVH surfaceTree;
+	std::set<size_t> unboundedSurfaces;
+	void update_surface_buffer();
+	// visible is indexed by surface handle
+	void cull_surfaces(const FrustumPlanes& planes, std::vector<uint8_t>& visible) const;
+	// Only sets visible for the surfaces with a pass of the type, and leaves the rest as they were
+	void cull_surfaces(Shader::Type type, const FrustumPlanes& planes, std::vector<uint8_t>& visible);
+
+  public:
+	// Surfaces whose world bounds overlap the box, as of the last frame. Ids are SurfaceHandle::id, stable while the
+	// surface lives
+	std::vector<size_t> surfaces_in_box(vec3 min, vec3 max) const;
+
+  protected:
+	// Transforms shared down a tree of nodes. Surfaces attached to a node take its world transform, and are only
+	// reuploaded when it changes
+	struct TransformNode {
+		std::unordered_set<size_t> surfaces;
+	};
+	INSTANCE_CONTAINER(TransformNode, transform_nodes, Core)
+	// Local and world matrices by node handle
+	TransformHierarchy transformHierarchy;
+	// Returns how many node world transforms changed
+	size_t update_transforms();
+
+  public:
+	TransformNodeHandle transform_node_create(mat4 local = mat4(1.0f)) {
+		TransformNodeHandle handle = transform_nodes_insert(TransformNode{});
+		transformHierarchy.insert(handle.handle, TransformHierarchy::none, local);
+		return handle;
+	}
+	TransformNodeHandle transform_node_create(TransformNodeHandle& parent, mat4 local = mat4(1.0f)) {
+		TransformNodeHandle handle = transform_nodes_insert(TransformNode{});
+		transformHierarchy.insert(handle.handle, parent.handle, local);
+		return handle;
+	}
+
+	// Returns false without reparenting when parent is the node or below it
+	bool transform_node_set_parent(TransformNodeHandle& node, TransformNodeHandle& parent) {
+		return transformHierarchy.set_parent(node.handle, parent.handle);
+	}
+	void transform_node_clear_parent(TransformNodeHandle& node) {
+		transformHierarchy.set_parent(node.handle, TransformHierarchy::none);
+	}
+
+	mat4 transform_node_get_local(TransformNodeHandle& node) { return transformHierarchy.local(node.handle); }
+	void transform_node_set_local(TransformNodeHandle& node, mat4 local) {
+		transformHierarchy.set_local(node.handle, local);
+	}
+	// As of the last frame
+	mat4 transform_node_get_world(TransformNodeHandle& node) { return transformHierarchy.world(node.handle); }
+
+	// Children move up to the node's parent, and its surfaces stay where they are
+	void transform_node_delete(TransformNodeHandle node) { transform_nodes_delete(std::move(node)); }
+
+	void surface_set_node(SurfaceHandle& surface, TransformNodeHandle& node);
+	void surface_clear_node(SurfaceHandle& surface);
+
   protected:
 	struct DirLight {
 		vec3 dir;
@@ -226,6 +385,58 @@ class Core {
 
 	void dir_light_set_colour(DirLightHandle& handle, vec3 colour) { dir_lights_get(handle).colour = colour; }
 	void dir_light_set_dir(DirLightHandle& handle, vec3 dir) { dir_lights_get(handle).dir = normalize(dir); }
+
+  protected:
+	// Local lights fade out smoothly at range
+	struct PointLight {
+		vec3 pos;
+		vec3 colour;
+		float range;
+	};
+	INSTANCE_CONTAINER(PointLight, point_lights, Core)
+  public:
+	PointLightHandle point_light_create(vec3 colour, vec3 pos, float range) {
+		return point_lights_insert(PointLight{.pos = pos, .colour = colour, .range = range});
+	}
+
+	void point_light_set_colour(PointLightHandle& handle, vec3 colour) { point_lights_get(handle).colour = colour; }
+	void point_light_set_pos(PointLightHandle& handle, vec3 pos) { point_lights_get(handle).pos = pos; }
+	void point_light_set_range(PointLightHandle& handle, float range) { point_lights_get(handle).range = range; }
+	void point_light_delete(PointLightHandle handle) { point_lights_delete(std::move(handle)); }
+
+  protected:
+	// Cone angles are in radians from the axis, the light fades from full at innerAngle to none at outerAngle
+	struct SpotLight {
+		vec3 pos;
+		vec3 dir;
+		vec3 colour;
+		float range;
+		float innerAngle;
+		float outerAngle;
+	};
+	INSTANCE_CONTAINER(SpotLight, spot_lights, Core)
+  public:
+	SpotLightHandle
+	spot_light_create(vec3 colour, vec3 pos, vec3 dir, float range, float inner_angle, float outer_angle) {
+		SpotLightHandle handle = spot_lights_insert(SpotLight{});
+		spot_light_set_colour(handle, colour);
+		spot_light_set_pos(handle, pos);
+		spot_light_set_dir(handle, dir);
+		spot_light_set_range(handle, range);
+		spot_light_set_cone(handle, inner_angle, outer_angle);
+		return handle;
+	}
+
+	void spot_light_set_colour(SpotLightHandle& handle, vec3 colour) { spot_lights_get(handle).colour = colour; }
+	void spot_light_set_pos(SpotLightHandle& handle, vec3 pos) { spot_lights_get(handle).pos = pos; }
+	void spot_light_set_dir(SpotLightHandle& handle, vec3 dir) { spot_lights_get(handle).dir = normalize(dir); }
+	void spot_light_set_range(SpotLightHandle& handle, float range) { spot_lights_get(handle).range = range; }
+	void spot_light_set_cone(SpotLightHandle& handle, float inner_angle, float outer_angle) {
+		auto& light = spot_lights_get(handle);
+		light.outerAngle = std::clamp(outer_angle, 0.0f, glm::half_pi<float>());
+		light.innerAngle = std::clamp(inner_angle, 0.0f, light.outerAngle);
+	}
+	void spot_light_delete(SpotLightHandle handle) { spot_lights_delete(std::move(handle)); }
 	// End Instances
 
   protected:
@@ -237,28 +448,152 @@ class Core {
 		vec3 camPos;
 	};
 
-	int width, height;
+	int width = 0, height = 0;
 
-	GLuint cameraBuffer;
-	float fov;
-	mat4 cameraPos;
+	FrameRing frameRing;
+	void bind_camera(const Camera& camera);
+
+	GpuTimers gpuTimers;
 
-	const int lightmapSize = 4096;
-	const float lightmapCoverage = 50;
+	float fov = 0;
+	mat4 cameraPos;
 
-	GLuint dirLightBuffer, dirLightShadow;
+	// Cascaded shadow maps: each directional light covers the view out to shadowDistance with shadowCascades maps,
+	// split between logarithmic and uniform by cascadeSplitLambda
+	static const int shadowCascades = 4;
+	const float shadowDistance = 100;
+	const float cascadeSplitLambda = 0.75f;
+
+	// Every cascade gets its own tile of the shadow atlas. The brightest light gets maxShadowTileSize, dimmer ones
+	// shrink with their share of its luminance. The atlas grows and shrinks with the tiles it has to hold
+	const int maxShadowTileSize = 2048;
+	const int minShadowTileSize = 256;
+	const int maxShadowAtlasSize = 8192;
+	// 16 bit depth is used when its steps over the deepest cascade are within this many world units
+	const float shadowDepthTolerance = 0.01f;
+	GLenum shadowDepthFormat;
+	ShadowAtlas shadowAtlas;
+	int shadow_tile_size(vec3 colour, float maxLuminance) const;
+	void pack_shadow_atlas(const std::vector<int>& tileSizes);
+	void create_shadow_atlas();
+
+	GLuint dirLightShadow = 0;
+	GLuint shadowFramebuffer;
+	// Static casters are drawn into dirLightShadowStatic, which is copied into dirLightShadow under the dynamic
+	// casters. Until a surface is made dynamic it isn't allocated and static casters go straight to dirLightShadow
+	bool dynamicShadows = false;
+	GLuint dirLightShadowStatic = 0;
+	// One per cascade of each light
+	struct ShadowCache {
+		bool valid = false;
+		bool hadDynamic = false;
+		mat4 shadowMapTrans;
+		// The tile may be smaller than requested, or missing, when the atlas is full
+		int requestedSize = 0;
+		std::optional<ShadowAtlas::Tile> tile;
+	};
+	std::vector<ShadowCache> shadowCache;
+
+	// Local lights are binned by light_cluster.comp into a grid of clusters, clusterGrid.x by clusterGrid.y tiles
+	// across the screen and clusterGrid.z slices, exponentially spaced out to clusterDepth. Fragments past it use the
+	// last slice. Each cluster lists up to maxClusterLights lights
+	const uvec3 clusterGrid = {16, 9, 24};
+	const int maxClusterLights = 256;
+	const float clusterDepth = 500;
+	GLuint lightClusterProgram = 0;
+	GLuint clusterLightCounts;
+	GLuint clusterLightIndices;
+
+	// Hierarchical-Z occlusion culling. The scene is drawn into the multisampled sceneFramebuffer and resolved to the
+	// window at the end of run. After the depth prepass, hiz_init.comp and hiz_downsample.comp reduce its depth to a
+	// pyramid of the farthest depth under each texel. On the GPU path cull_draws.comp tests the opaque pass against
+	// it. The CPU path, and the transparent pass, test against a coarse level read back a frame or more late, so they
+	// leave dynamic surfaces alone
+	bool occlusionCulling = true;
+	const int maxSceneSamples = 8;
+	int sceneSamples = 0;
+	ivec2 sceneSize = {0, 0};
+	GLuint sceneFramebuffer = 0, sceneColour = 0, sceneDepth = 0, hiz = 0;
+	int hizLevels = 0;
+	GLuint hizInitProgram = 0, hizDownsampleProgram = 0;
+	static const int hizTextureUnit = 2;
+	void create_scene_targets();
+	void build_hiz();
+	// The level read back is the first no wider than hizReadbackWidth
+	const int hizReadbackWidth = 160;
+	struct HizReadback {
+		GLuint buffer = 0;
+		size_t capacity = 0;
+		GLsync fence = nullptr;
+		mat4 viewProj;
+		ivec2 size;
+	};
+	HizReadback hizReadback;
+	DepthPyramid occluders;
+	void read_back_hiz(const mat4& viewProj);
 
 	enum class RenderOrder {
 		Simple,
 		Shader,
 		Distance,
 	};
-	void renderScene(Shader::Type type, RenderOrder order = RenderOrder::Shader);
 
   public:
-	Core(void (*(const char*))());
+	// GPU culls the depth, opaque and shadow passes, the transparent pass is still sorted and culled on the CPU
+	enum class CullingMode { CPU, GPU };
+
+  protected:
+	// GPU driven drawing: the surfaces of each material pass form a bucket, cull_draws.comp writes an indirect
+	// command per visible surface and each bucket is drawn by one glMultiDrawElementsIndirectCount
+	CullingMode cullingMode = CullingMode::CPU;
+	GLuint cullDrawsProgram = 0;
+	GLuint surfaceDrawBuffer = 0;
+	size_t surfaceDrawBufferCapacity = 0;
+	struct DrawList {
+		struct Bucket {
+			size_t shader;
+			size_t material;
+			GLuint first;
+			GLuint size;
+		};
+		std::vector<Bucket> buckets;
+		GLuint size = 0;
+		// Surface handle and bucket of each entry, first command of each bucket, visible count of each bucket
+		GLuint entries = 0, bucketFirsts = 0, counts = 0, commands = 0;
+		// The counts copied back for stats, a frame or more late
+		GLuint countsReadback = 0;
+		GLsync countsFence = nullptr;
+		GLuint visible = 0;
+	};
+	// Rebuilt when surfaces, materials or shaders change, for the Depth, Opaque and Shadow passes
+	bool drawListsDirty = true;
+	std::map<Shader::Type, DrawList> drawLists;
+	void update_draw_lists();
+	// The list's visible draws as of the last read back to finish, then starts reading back its current counts
+	GLuint read_back_draw_counts(DrawList& list);
+	// Transparent surfaces are still culled on the CPU on the GPU path, kept between frames so only theirs are set
+	std::vector<uint8_t> transparentVisible;
+	size_t dynamicSurfaces = 0;
+	// mask bit 0 draws static surfaces, bit 1 dynamic ones. occlusionViewProj, if given, also culls against hiz
+	void renderSceneIndirect(
+		Shader::Type type, const FrustumPlanes& planes, uint32_t mask = 3,
+		const mat4* occlusionViewProj = nullptr);
+
+	// Draws the mesh out of meshPool, whose vertex array must be bound
+	void draw_mesh(const Mesh& mesh, GLsizei instances, GLuint baseInstance);
+	// instances > 1 draws every surface that many times, for shaders that route instances to framebuffer layers.
+	// visible, if given, is indexed by surface handle and skips the surfaces that are 0
+	void renderScene(
+		Shader::Type type, RenderOrder order = RenderOrder::Shader, GLsizei instances = 1,
+		const std::vector<uint8_t>* visible = nullptr);
+
+  public:
+	Core(void (*(const char*))(), JobSystem& jobs);
 	Core(const Core&) = delete;
 
+	// Only for CPU work, GL calls stay on the thread that owns the context
+	JobSystem& job_system() { return jobs; }
+
 	void resize(int width, int height) {
 		this->width = width;
 		this->height = height;
@@ -267,6 +602,9 @@ class Core {
 	void camera_set_pos(mat4 pos) { cameraPos = glm::inverse(pos); }
 	void camera_set_fov(float degrees) { fov = radians(degrees); }
 
+	// Applies a frame of changes recorded by the simulation, which may run on another thread
+	void apply_snapshot(const SceneSnapshot& snapshot);
+
 	enum TextureFlags { NONE = 0, SRGB = 1 << 0, MIPMAPPED = 1 << 1, ANIOSTROPIC = 1 << 2, CLAMPED = 1 << 3 };
 	friend inline TextureFlags operator|(const TextureFlags lhs, const TextureFlags rhs) {
 		return static_cast<TextureFlags>(static_cast<int>(lhs) | static_cast<int>(rhs));
@@ -274,6 +612,46 @@ class Core {
 	TextureHandle create_texture(int width, int height, int channels, TextureFlags flags, void* data);
 
 	void run();
+
+	struct PickResult {
+		// SurfaceHandle::id of the surface hit
+		size_t surface;
+		uint32_t triangle;
+		// Weights of the triangle's second and third vertices
+		vec2 barycentrics;
+		float distance;
+		vec3 position;
+	};
+	// Casts a ray from the camera through a pixel of the framebuffer, from its top left, against the surfaces as of
+	// the last frame
+	std::optional<PickResult> pick(double x, double y);
+
+	void set_culling_mode(CullingMode mode) { cullingMode = mode; }
+	void set_occlusion_culling(bool enabled) { occlusionCulling = enabled; }
+
+	std::vector<GpuTimers::Timing> gpu_timings() const { return gpuTimers.timings(); }
+
+	struct Stats {
+		size_t shadowDraws = 0;
+		size_t shadowCulled = 0;
+		size_t shadowCascadesCached = 0;
+		bool gpuCulling = false;
+		// On the GPU path these count the opaque pass's draws, read back a frame or more late
+		size_t surfacesVisible = 0;
+		size_t surfacesCulled = 0;
+		// Only counted on the CPU path
+		size_t surfacesOccluded = 0;
+		size_t bvhNodes = 0;
+		size_t transformNodes = 0;
+		size_t transformsUpdated = 0;
+		size_t localLights = 0;
+		int shadowAtlasSize = 0;
+		size_t shadowAtlasBytes = 0;
+	};
+	const Stats& stats() const { return frameStats; }
+
+  protected:
+	Stats frameStats;
 };
 
 typedef Core::MeshHandle MeshHandle;
@@ -282,5 +660,8 @@ typedef Core::MaterialHandle MaterialHandle;
 
 typedef Core::SurfaceHandle SurfaceHandle;
 typedef Core::DirLightHandle DirLightHandle;
+typedef Core::PointLightHandle PointLightHandle;
+typedef Core::SpotLightHandle SpotLightHandle;
+typedef Core::TransformNodeHandle TransformNodeHandle;
 
 } // namespace Render
\ No newline at end of file
@@ -0,0 +1,146 @@
+#include "culling.hpp"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CULLING_SSE
+#endif
+
+namespace Render {
+
+FrustumPlanes frustum_planes(const glm::mat4& viewProj, bool nearPlane) {
+	// Gribb and Hartmann: each plane is the w row plus or minus another row of the matrix
+	auto row = [&](int r) { return glm::vec4(viewProj[0][r], viewProj[1][r], viewProj[2][r], viewProj[3][r]); };
+	return {
+		row(3) + row(0),
+		row(3) - row(0),
+		row(3) + row(1),
+		row(3) - row(1),
+		nearPlane ? row(3) + row(2) : glm::vec4(0, 0, 0, 1),
+		row(3) - row(2),
+	};
+}
+
+FrustumTest::FrustumTest(const FrustumPlanes& planes) {
+	for (size_t p = 0; p < 8; p++) {
+		glm::vec4 plane = p < planes.size() ? planes[p] : glm::vec4(0, 0, 0, 1);
+		x[p] = plane.x;
+		y[p] = plane.y;
+		z[p] = plane.z;
+		w[p] = plane.w;
+	}
+}
+
+uint32_t FrustumTest::classify(glm::vec3 min, glm::vec3 max, uint32_t active) const {
+	// Outside a plane when the corner furthest along its normal is behind it, inside when the nearest corner isn't
+	uint32_t behind = 0, inside = 0;
+#ifdef CULLING_SSE
+	__m128 minX = _mm_set1_ps(min.x), minY = _mm_set1_ps(min.y), minZ = _mm_set1_ps(min.z);
+	__m128 maxX = _mm_set1_ps(max.x), maxY = _mm_set1_ps(max.y), maxZ = _mm_set1_ps(max.z);
+	for (int g = 0; g < 2; g++) {
+		__m128 nx = _mm_load_ps(&x[4 * g]), ny = _mm_load_ps(&y[4 * g]), nz = _mm_load_ps(&z[4 * g]);
+		__m128 ax = _mm_mul_ps(nx, minX), bx = _mm_mul_ps(nx, maxX);
+		__m128 ay = _mm_mul_ps(ny, minY), by = _mm_mul_ps(ny, maxY);
+		__m128 az = _mm_mul_ps(nz, minZ), bz = _mm_mul_ps(nz, maxZ);
+		__m128 furthest = _mm_add_ps(
+			_mm_load_ps(&w[4 * g]),
+			_mm_add_ps(_mm_max_ps(ax, bx), _mm_add_ps(_mm_max_ps(ay, by), _mm_max_ps(az, bz))));
+		__m128 nearest = _mm_add_ps(
+			_mm_load_ps(&w[4 * g]),
+			_mm_add_ps(_mm_min_ps(ax, bx), _mm_add_ps(_mm_min_ps(ay, by), _mm_min_ps(az, bz))));
+		behind |= _mm_movemask_ps(_mm_cmplt_ps(furthest, _mm_setzero_ps())) << (4 * g);
+		inside |= _mm_movemask_ps(_mm_cmpge_ps(nearest, _mm_setzero_ps())) << (4 * g);
+	}
+#else
+	for (int p = 0; p < 8; p++) {
+		float ax = x[p] * min.x, bx = x[p] * max.x, ay = y[p] * min.y, by = y[p] * max.y;
+		float az = z[p] * min.z, bz = z[p] * max.z;
+		float furthest = w[p] + std::max(ax, bx) + std::max(ay, by) + std::max(az, bz);
+		float nearest = w[p] + std::min(ax, bx) + std::min(ay, by) + std::min(az, bz);
+		behind |= uint32_t(furthest < 0) << p;
+		inside |= uint32_t(nearest >= 0) << p;
+	}
+#endif
+	if (behind & active)
+		return outside;
+	return active & ~inside;
+}
+
+void OcclusionBounds::resize(size_t count) {
+	for (auto* v : {&minX, &minY, &minZ, &maxX, &maxY, &maxZ})
+		v->resize(count);
+}
+
+void OcclusionBounds::set(size_t i, glm::vec3 min, glm::vec3 max) {
+	minX[i] = min.x;
+	minY[i] = min.y;
+	minZ[i] = min.z;
+	maxX[i] = max.x;
+	maxY[i] = max.y;
+	maxZ[i] = max.z;
+}
+
+void OcclusionBounds::occlusion_cull(const DepthPyramid& depth, std::vector<uint8_t>& visible, JobSystem& jobs) const {
+	jobs.parallel_for(size(), 4096, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			if (visible[i] && depth.occluded({minX[i], minY[i], minZ[i]}, {maxX[i], maxY[i], maxZ[i]}))
+				visible[i] = 0;
+	});
+}
+
+void DepthPyramid::build(const glm::mat4& viewProj, int width, int height, std::vector<float> depth) {
+	this->viewProj = viewProj;
+	levels.clear();
+	sizes.clear();
+	levels.push_back(std::move(depth));
+	sizes.push_back({width, height});
+	// Same reduction as hiz_downsample.comp, odd sized levels fold their last row and column into the texels before
+	while (sizes.back().x > 1 || sizes.back().y > 1) {
+		glm::ivec2 prev = sizes.back();
+		glm::ivec2 size = glm::max(prev / 2, glm::ivec2(1));
+		std::vector<float> level(size.x * size.y, 0.0f);
+		auto& src = levels.back();
+		for (int y = 0; y < prev.y; y++)
+			for (int x = 0; x < prev.x; x++) {
+				float& texel = level[std::min(y / 2, size.y - 1) * size.x + std::min(x / 2, size.x - 1)];
+				texel = std::max(texel, src[y * prev.x + x]);
+			}
+		levels.push_back(std::move(level));
+		sizes.push_back(size);
+	}
+}
+
+bool DepthPyramid::occluded(glm::vec3 min, glm::vec3 max) const {
+	glm::vec3 ndcMin(1), ndcMax(-1);
+	for (int c = 0; c < 8; c++) {
+		glm::vec3 corner = {(c & 1) ? max.x : min.x, (c & 2) ? max.y : min.y, (c & 4) ? max.z : min.z};
+		glm::vec4 clip = viewProj * glm::vec4(corner, 1);
+		if (clip.w <= 0)
+			return false;
+		glm::vec3 ndc = glm::vec3(clip) / clip.w;
+		ndcMin = glm::min(ndcMin, ndc);
+		ndcMax = glm::max(ndcMax, ndc);
+	}
+
+	// Pick the level where the box's rect spans at most two texels each way
+	glm::ivec2 size = sizes[0];
+	auto texel = [&](glm::vec3 ndc) {
+		glm::vec2 uv = glm::clamp(glm::vec2(ndc) * 0.5f + 0.5f, 0.0f, 1.0f);
+		return glm::min(glm::ivec2(uv * glm::vec2(size)), size - 1);
+	};
+	glm::ivec2 lo = texel(ndcMin), hi = texel(ndcMax);
+	int span = std::max(hi.x - lo.x, hi.y - lo.y);
+	int level = 0;
+	while ((1 << level) < span && level + 1 < static_cast<int>(levels.size()))
+		level++;
+
+	glm::ivec2 levelSize = sizes[level];
+	float farthest = 0;
+	for (int y = std::min(lo.y >> level, levelSize.y - 1); y <= std::min(hi.y >> level, levelSize.y - 1); y++)
+		for (int x = std::min(lo.x >> level, levelSize.x - 1); x <= std::min(hi.x >> level, levelSize.x - 1); x++)
+			farthest = std::max(farthest, levels[level][y * levelSize.x + x]);
+	return ndcMin.z * 0.5f + 0.5f > farthest;
+}
+
+} // namespace Render
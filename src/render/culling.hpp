@@ -0,0 +1,59 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "job_system.hpp"
+
+namespace Render {
+
+// Farthest depth pyramid on the CPU, built from a level of the GPU's Hi-Z read back a frame or more late
+class DepthPyramid {
+	glm::mat4 viewProj = glm::mat4(1.0f);
+	std::vector<std::vector<float>> levels;
+	std::vector<glm::ivec2> sizes;
+
+  public:
+	// depth is width * height window space depths, rendered with viewProj
+	void build(const glm::mat4& viewProj, int width, int height, std::vector<float> depth);
+	bool empty() const { return levels.empty(); }
+
+	// True when the box is entirely behind the depth it covers. Boxes crossing the camera plane never are
+	bool occluded(glm::vec3 min, glm::vec3 max) const;
+};
+
+typedef std::array<glm::vec4, 6> FrustumPlanes;
+// Planes of viewProj's clip volume, facing inwards. Without the near plane boxes behind it still pass, for shadow
+// maps that clamp casters onto it
+FrustumPlanes frustum_planes(const glm::mat4& viewProj, bool nearPlane = true);
+
+// Frustum planes as a structure of arrays, so a box is tested against four planes at a time
+class FrustumTest {
+	// Padded with planes every box is inside
+	alignas(16) std::array<float, 8> x, y, z, w;
+
+  public:
+	static constexpr uint32_t allPlanes = (1u << 6) - 1;
+	static constexpr uint32_t outside = ~0u;
+
+	explicit FrustumTest(const FrustumPlanes& planes);
+	// The planes of active the box still straddles, or outside when it's entirely behind one of them
+	uint32_t classify(glm::vec3 min, glm::vec3 max, uint32_t active = allPlanes) const;
+};
+
+// World space boxes, kept as a structure of arrays for the Hi-Z occlusion tests
+class OcclusionBounds {
+	std::vector<float> minX, minY, minZ, maxX, maxY, maxZ;
+
+  public:
+	void resize(size_t count);
+	size_t size() const { return minX.size(); }
+	void set(size_t i, glm::vec3 min, glm::vec3 max);
+
+	// Clears visible[i] for the boxes the pyramid occludes, large sets are split across the jobs
+	void occlusion_cull(const DepthPyramid& depth, std::vector<uint8_t>& visible, JobSystem& jobs) const;
+};
+
+} // namespace Render
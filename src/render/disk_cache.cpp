@@ -0,0 +1,154 @@
+#include "disk_cache.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+#include "gl.hpp"
+
+namespace Render {
+
+std::filesystem::path cache_directory() {
+	std::filesystem::path directory;
+	if (const char* xdg = std::getenv("XDG_CACHE_HOME"))
+		directory = std::filesystem::path(xdg) / "marble";
+	else if (const char* local = std::getenv("LOCALAPPDATA"))
+		directory = std::filesystem::path(local) / "marble";
+	else if (const char* home = std::getenv("HOME"))
+		directory = std::filesystem::path(home) / ".cache" / "marble";
+	else
+		directory = std::filesystem::temp_directory_path() / "marble";
+
+	std::error_code error;
+	std::filesystem::create_directories(directory, error);
+	return directory;
+}
+
+uint64_t hash_bytes(const void* data, size_t size, uint64_t hash) {
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3;
+	}
+	return hash;
+}
+
+std::optional<uint64_t> hash_file(const std::filesystem::path& path) {
+	auto data = read_file(path);
+	if (!data)
+		return {};
+	return hash_vector(data.value());
+}
+
+std::optional<std::vector<char>> read_file(const std::filesystem::path& path) {
+	std::ifstream file(path, std::ifstream::binary | std::ifstream::ate);
+	if (!file)
+		return {};
+	std::vector<char> data(file.tellg());
+	file.seekg(0);
+	file.read(data.data(), data.size());
+	if (!file)
+		return {};
+	return data;
+}
+
+void write_file(const std::filesystem::path& path, const std::vector<char>& data) {
+	auto temp = path;
+	temp += ".tmp";
+	// The temporary file is removed if anything fails, so none are left in the cache
+	std::error_code error;
+	{
+		std::ofstream file(temp, std::ofstream::binary | std::ofstream::trunc);
+		file.write(data.data(), data.size());
+		file.close();
+		if (!file) {
+			std::filesystem::remove(temp, error);
+			return;
+		}
+	}
+	std::filesystem::rename(temp, path, error);
+	if (error)
+		std::filesystem::remove(temp, error);
+}
+
+void ProgramCache::init() {
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	supported = formats > 0;
+
+	// Binaries are only valid for the driver that produced them
+	for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+		std::string string = reinterpret_cast<const char*>(glGetString(name));
+		driver = hash_bytes(string.data(), string.size(), driver);
+	}
+
+	directory = cache_directory() / "programs";
+	std::error_code error;
+	std::filesystem::create_directories(directory, error);
+	if (error)
+		supported = false;
+}
+
+std::filesystem::path ProgramCache::path(uint64_t key) {
+	char name[32];
+	std::snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(hash_bytes(&driver, 8, key)));
+	return directory / name;
+}
+
+struct ProgramBinaryHeader {
+	uint32_t magic;
+	GLenum format;
+	uint32_t length;
+};
+const uint32_t programBinaryMagic = 0x4d50424e;
+
+std::optional<GLuint> ProgramCache::load(uint64_t key) {
+	if (!supported)
+		return {};
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	auto data = read_file(path(key));
+	ProgramBinaryHeader header;
+	if (!data || data->size() < sizeof(header))
+		return {};
+	std::memcpy(&header, data->data(), sizeof(header));
+	if (header.magic != programBinaryMagic || data->size() != sizeof(header) + header.length)
+		return {};
+
+	GLuint program = glCreateProgram();
+	glProgramBinary(program, header.format, data->data() + sizeof(header), header.length);
+	GLint status;
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (!status) {
+		// Usually a driver update; Fall back to linking from SPIR-V, which replaces the stale binary
+		glDeleteProgram(program);
+		return {};
+	}
+
+	stats.hits++;
+	stats.load_ms +=
+		std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	return program;
+}
+
+void ProgramCache::store(uint64_t key, GLuint program) {
+	if (!supported)
+		return;
+
+	GLint length;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+
+	ProgramBinaryHeader header = {.magic = programBinaryMagic, .format = 0, .length = static_cast<uint32_t>(length)};
+	std::vector<char> data(sizeof(header) + length);
+	glGetProgramBinary(program, length, nullptr, &header.format, data.data() + sizeof(header));
+	std::memcpy(data.data(), &header, sizeof(header));
+
+	write_file(path(key), data);
+}
+
+} // namespace Render
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace Render {
+
+// Per-user directory for data that can be regenerated, created on first use
+std::filesystem::path cache_directory();
+
+// FNV-1a, for cache keys
+uint64_t hash_bytes(const void* data, size_t size, uint64_t hash = 0xcbf29ce484222325);
+template <class T> uint64_t hash_vector(const std::vector<T>& data, uint64_t hash = 0xcbf29ce484222325) {
+	return hash_bytes(data.data(), data.size() * sizeof(T), hash);
+}
+// Hash of a file's contents, or nothing if it can't be read
+std::optional<uint64_t> hash_file(const std::filesystem::path& path);
+
+// Whole-file IO. Writes go through a temporary file so a crash never leaves a truncated cache entry
+std::optional<std::vector<char>> read_file(const std::filesystem::path& path);
+void write_file(const std::filesystem::path& path, const std::vector<char>& data);
+
+// Linked program binaries, keyed by the caller's hash of the program source together with the driver in use
+class ProgramCache {
+	typedef unsigned int GLuint;
+
+	std::filesystem::path directory;
+	uint64_t driver = 0;
+	bool supported = false;
+
+	std::filesystem::path path(uint64_t key);
+
+  public:
+	struct Stats {
+		int hits = 0;
+		int misses = 0;
+		double load_ms = 0;
+		double link_ms = 0;
+	} stats;
+
+	ProgramCache() {}
+	ProgramCache(const ProgramCache&) = delete;
+
+	void init();
+
+	bool enabled() { return supported; }
+
+	// Returns a linked program, or nothing if there is no usable binary for key
+	std::optional<GLuint> load(uint64_t key);
+	// The program must have been linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+	void store(uint64_t key, GLuint program);
+};
+
+} // namespace Render
@@ -0,0 +1,78 @@
+#include "frame_ring.hpp"
+
+#include <algorithm>
+
+#include "gl.hpp"
+
+namespace Render {
+
+static void wait_fence(GLsync fence) {
+	if (!fence)
+		return;
+	while (true) {
+		GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+		if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED)
+			break;
+	}
+	glDeleteSync(fence);
+}
+
+void FrameRing::init(size_t size) {
+	GLint uniformAlignment, storageAlignment;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+	glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageAlignment);
+	alignment = std::max<size_t>({static_cast<size_t>(uniformAlignment), static_cast<size_t>(storageAlignment), 16});
+
+	create(size);
+}
+
+void FrameRing::create(size_t size) {
+	frameSize = (size + alignment - 1) / alignment * alignment;
+
+	const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glCreateBuffers(1, &buffer);
+	glNamedBufferStorage(buffer, frameSize * frames, nullptr, flags);
+	mapped = static_cast<uint8_t*>(glMapNamedBufferRange(buffer, 0, frameSize * frames, flags));
+}
+
+FrameRing::Allocation FrameRing::allocate(size_t size) {
+	size_t offset = (head + alignment - 1) / alignment * alignment;
+	if (offset + size > frameSize) {
+		// Out of space this frame; Earlier allocations (and other frames still in flight) keep using the old buffer
+		// until the GPU is done with this frame
+		retired.push_back({buffer, nullptr});
+		size_t newSize = frameSize * 2;
+		while (newSize < size)
+			newSize *= 2;
+		create(newSize);
+		offset = 0;
+	}
+	head = offset + size;
+
+	size_t base = frameSize * frame;
+	return Allocation{.buffer = buffer, .offset = base + offset, .size = size, .data = mapped + base + offset};
+}
+
+void FrameRing::end_frame() {
+	GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	fences[frame] = fence;
+
+	for (auto& r : retired) {
+		if (!r.fence)
+			r.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+	std::erase_if(retired, [](Retired& r) {
+		if (glClientWaitSync(r.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+			return false;
+		glDeleteSync(r.fence);
+		glDeleteBuffers(1, &r.buffer);
+		return true;
+	});
+
+	frame = (frame + 1) % frames;
+	head = 0;
+	wait_fence(fences[frame]);
+	fences[frame] = nullptr;
+}
+
+} // namespace Render
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+typedef struct __GLsync* GLsync;
+
+namespace Render {
+
+// Persistently mapped ring of per-frame upload space.
+// Each frame in flight owns one segment of the buffer; a segment is only reused once the fence placed at the end of
+// the frame that last wrote to it has signalled, so writes never have to synchronise with the GPU.
+class FrameRing {
+	typedef unsigned int GLuint;
+
+  public:
+	static const int frames = 3;
+
+	struct Allocation {
+		GLuint buffer;
+		size_t offset;
+		size_t size;
+		void* data;
+	};
+
+  private:
+	GLuint buffer = 0;
+	uint8_t* mapped = nullptr;
+	size_t frameSize = 0;
+	size_t alignment = 0;
+
+	int frame = 0;
+	size_t head = 0;
+	std::array<GLsync, frames> fences = {};
+
+	struct Retired {
+		GLuint buffer;
+		GLsync fence;
+	};
+	std::vector<Retired> retired;
+
+	void create(size_t frameSize);
+
+  public:
+	FrameRing() {}
+	FrameRing(const FrameRing&) = delete;
+
+	void init(size_t frameSize);
+
+	Allocation allocate(size_t size);
+
+	template <class T> Allocation push(const T& value) {
+		Allocation allocation = allocate(sizeof(T));
+		std::memcpy(allocation.data, &value, sizeof(T));
+		return allocation;
+	}
+	template <class T> Allocation push(const std::vector<T>& values) {
+		Allocation allocation = allocate(sizeof(T) * values.size());
+		std::memcpy(allocation.data, values.data(), sizeof(T) * values.size());
+		return allocation;
+	}
+
+	// Fence everything allocated since the last call and move on to the next segment, waiting for the GPU if it is
+	// still reading from it
+	void end_frame();
+};
+
+} // namespace Render
@@ -574,7 +574,7 @@ struct Gltf {
 };
 
 void accessor_for_each(
-	const Gltf& gltf, const std::vector<std::vector<uint8_t>> buffers_data, size_t accessor_index,
+	const Gltf& gltf, const std::vector<std::vector<uint8_t>>& buffers_data, size_t accessor_index,
 	std::function<void(size_t index, const void* data)> functor) {
 	const Gltf::Accessor& accessor = gltf.accessors[accessor_index];
 	const Gltf::BufferView& bufferView = gltf.bufferViews[accessor.bufferView.value()];
@@ -675,20 +675,21 @@ dmat4 convert_transform(const Gltf::Node& node) {
 }
 
 void crawl_nodes(
-	const Gltf& gltf, const std::vector<uint64>& nodes, std::vector<Model::Surface>& surfaces,
-	const std::vector<std::vector<Model::Surface>>& models, const dmat4& parent_transform = mat4(1.0)) {
+	const Gltf& gltf, const std::vector<uint64>& nodes, Model& model,
+	const std::vector<std::vector<Model::Surface>>& models, std::optional<size_t> parent = {}) {
 	for (uint64 n : nodes) {
 		auto& node = gltf.nodes[n];
-		const dmat4 transform = parent_transform * convert_transform(node);
+		size_t index = model.nodes.size();
+		model.nodes.push_back(Model::Node{.parent = parent, .transform = mat4(convert_transform(node))});
 
 		if (node.mesh.has_value()) {
 			for (auto mesh : models[node.mesh.value()]) {
-				mesh.transform = transform;
-				surfaces.push_back(mesh);
+				mesh.node = index;
+				model.surfaces.push_back(mesh);
 			}
 		}
 
-		crawl_nodes(gltf, node.children, surfaces, models, transform);
+		crawl_nodes(gltf, node.children, model, models, index);
 	}
 }
 
@@ -853,6 +854,113 @@ struct GLB {
 	}
 };
 
+StandardMesh decode_primitive(
+	const Gltf& gltf, const std::vector<std::vector<uint8_t>>& buffers_data, const Gltf::Mesh::Primitive& prim) {
+	size_t count = gltf.accessors[prim.attributes.position.value()].count;
+	bool has_position = prim.attributes.position.has_value();
+	bool has_normal = prim.attributes.normal.has_value();
+	bool has_tangent = prim.attributes.tangent.has_value();
+	size_t num_uv = prim.attributes.texcoord.size();
+	size_t num_colour = prim.attributes.color.size();
+	StandardMesh mesh(
+		count,
+		{has_position, has_normal, has_tangent, has_tangent, num_uv > 0, num_uv > 1, num_uv > 2, num_uv > 3,
+		 num_colour > 0, num_colour > 1});
+	accessor_for_each(
+		gltf, buffers_data, prim.attributes.position.value(), [&mesh](size_t vertex, const void* data) {
+			mesh.position(vertex) = *reinterpret_cast<const glm::vec3*>(data);
+		});
+
+	if (prim.attributes.normal.has_value()) {
+		accessor_for_each(
+			gltf, buffers_data, prim.attributes.normal.value(), [&mesh](size_t vertex, const void* data) {
+				mesh.normal(vertex) = *reinterpret_cast<const glm::vec3*>(data);
+			});
+	}
+
+	if (prim.attributes.tangent.has_value()) {
+		accessor_for_each(
+			gltf, buffers_data, prim.attributes.tangent.value(), [&mesh](size_t vertex, const void* data) {
+				const vec3& tangent = *reinterpret_cast<const glm::vec3*>(data);
+				const float& sign = *reinterpret_cast<const float*>(reinterpret_cast<const glm::vec3*>(data) + 1);
+				mesh.tangent(vertex) = tangent;
+				mesh.bitangent(vertex) = (sign * cross(mesh.normal(vertex), tangent));
+			});
+	}
+
+	for (size_t t = 0; t < prim.attributes.texcoord.size(); t++) {
+		static const std::unordered_map<Gltf::ComponentType, std::function<vec2(const void*)>> convert_funcs = {
+			{Gltf::ComponentType::FLOAT, [](const void* data) { return *reinterpret_cast<const vec2*>(data); }},
+			{Gltf::ComponentType::UNSIGNED_BYTE,
+			 [](const void* data) { return unpackUnorm2x8(*reinterpret_cast<const uint16*>(data)); }},
+			{Gltf::ComponentType::UNSIGNED_SHORT,
+			 [](const void* data) { return unpackUnorm2x16(*reinterpret_cast<const uint32*>(data)); }}};
+
+		const Gltf::Accessor& accessor = gltf.accessors[prim.attributes.texcoord[t]];
+		const std::function<vec2(const void*)> convert_func = convert_funcs.at(accessor.componentType);
+		accessor_for_each(
+			gltf, buffers_data, prim.attributes.texcoord[t], [&mesh, convert_func, t](size_t index, const void* data) {
+				mesh.tex_coord(t, index) = convert_func(data);
+			});
+	}
+
+	for (size_t c = 0; c < prim.attributes.color.size(); c++) {
+		static const std::unordered_map<
+			Gltf::Accessor::Type, std::unordered_map<Gltf::ComponentType, std::function<vec4(const void*)>>>
+			convert_funcs = {
+				{Gltf::Accessor::Type::VEC4,
+				 {
+					 {Gltf::ComponentType::FLOAT,
+					  [](const void* data) { return *reinterpret_cast<const vec4*>(data); }},
+					 {Gltf::ComponentType::UNSIGNED_BYTE,
+					  [](const void* data) { return unpackUnorm4x8(*reinterpret_cast<const uint32*>(data)); }},
+					 {Gltf::ComponentType::UNSIGNED_SHORT,
+					  [](const void* data) { return unpackUnorm4x16(*reinterpret_cast<const uint64*>(data)); }},
+				 }},
+				{Gltf::Accessor::Type::VEC3,
+				 {
+					 {Gltf::ComponentType::FLOAT,
+					  [](const void* data) { return vec4(*reinterpret_cast<const vec3*>(data), 1.0); }},
+					 {Gltf::ComponentType::UNSIGNED_BYTE,
+					  [](const void* data) {
+						  return vec4((vec3(*reinterpret_cast<const u8vec3*>(data)) / 255.0f), 1.0f);
+					  }},
+					 {Gltf::ComponentType::UNSIGNED_SHORT,
+					  [](const void* data) {
+						  return vec4((vec3(*reinterpret_cast<const u16vec3*>(data)) / 65535.0f), 1.0f);
+					  }},
+				 }}};
+
+		const Gltf::Accessor& accessor = gltf.accessors[prim.attributes.color[c]];
+		const std::function<vec4(const void*)> convert_func =
+			convert_funcs.at(accessor.type).at(accessor.componentType);
+		accessor_for_each(
+			gltf, buffers_data, prim.indices.value(), [&mesh, convert_func, c](size_t index, const void* data) {
+				mesh.colour(c, index) = convert_func(data);
+			});
+	}
+
+	if (prim.indices.has_value()) {
+		static const std::unordered_map<Gltf::ComponentType, std::function<uint32(const void*)>> convert_funcs =
+			{{Gltf::ComponentType::UNSIGNED_BYTE,
+			  [](const void* data) { return *reinterpret_cast<const uint8*>(data); }},
+			 {Gltf::ComponentType::UNSIGNED_SHORT,
+			  [](const void* data) { return *reinterpret_cast<const uint16*>(data); }},
+			 {Gltf::ComponentType::UNSIGNED_INT,
+			  [](const void* data) { return *reinterpret_cast<const uint32*>(data); }}};
+
+		const Gltf::Accessor& accessor = gltf.accessors[prim.indices.value()];
+		mesh.indices.resize(accessor.count);
+		const std::function<uint32_t(const void*)> convert_func = convert_funcs.at(accessor.componentType);
+		accessor_for_each(
+			gltf, buffers_data, prim.indices.value(), [&mesh, convert_func](size_t index, const void* data) {
+				mesh.indices[index] = convert_func(data);
+			});
+	}
+
+	return mesh;
+}
+
 Model load_gltf(std::filesystem::path path, Render& render) {
 	std::ifstream gltf_file(path, std::ifstream::binary);
 	json j;
@@ -878,28 +986,36 @@ Model load_gltf(std::filesystem::path path, Render& render) {
 
 	std::vector<ImageData> images;
 	images.resize(gltf.images.size());
-	for (size_t i = 0; i < gltf.images.size(); i++) {
-		const auto& image = gltf.images[i];
-		std::vector<uint8> encoded_data;
-		if (image.bufferView.has_value()) {
-			const auto& bufferView = gltf.bufferViews[image.bufferView.value()];
-			const auto& buffer = buffers_data[bufferView.buffer];
-
-			const auto begin = buffer.begin() + bufferView.byteOffset;
-			const auto end = begin + bufferView.byteLength;
-
-			encoded_data = std::vector<uint8>(begin, end);
-		}
-		if (image.uri.has_value()) {
-			load_uri(image.uri.value(), path, encoded_data);
-		}
+	// Decoding is independent for each image, so they are spread across the jobs
+	render.job_system().parallel_for(
+		gltf.images.size(), 1,
+		[&](size_t first, size_t last) {
+			for (size_t i = first; i < last; i++) {
+				const auto& image = gltf.images[i];
+				std::vector<uint8> encoded_data;
+				if (image.bufferView.has_value()) {
+					const auto& bufferView = gltf.bufferViews[image.bufferView.value()];
+					const auto& buffer = buffers_data[bufferView.buffer];
+
+					const auto begin = buffer.begin() + bufferView.byteOffset;
+					const auto end = begin + bufferView.byteLength;
+
+					encoded_data = std::vector<uint8>(begin, end);
+				}
+				if (image.uri.has_value()) {
+					load_uri(image.uri.value(), path, encoded_data);
+				}
 
-		auto& image_data = images[i];
-		uint8* data = stbi_load_from_memory(
-			encoded_data.data(), encoded_data.size(), &image_data.width, &image_data.height, &image_data.channels, 0);
-		image_data.data = std::vector<uint8>(data, data + image_data.width * image_data.height * image_data.channels);
-		stbi_image_free(data);
-	}
+				auto& image_data = images[i];
+				uint8* data = stbi_load_from_memory(
+					encoded_data.data(), encoded_data.size(), &image_data.width, &image_data.height,
+					&image_data.channels, 0);
+				image_data.data =
+					std::vector<uint8>(data, data + image_data.width * image_data.height * image_data.channels);
+				stbi_image_free(data);
+			}
+		},
+		"Decode glTF image");
 
 	MaterialHandle default_material = render.create_pbr_material(convert_material(gltf, images, Gltf::Material{}));
 
@@ -911,129 +1027,40 @@ Model load_gltf(std::filesystem::path path, Render& render) {
 			return render.create_pbr_material(convert_material(gltf, images, material));
 		});
 
-	std::vector<std::vector<Model::Surface>> models;
-	models.resize(gltf.meshes.size());
-	for (size_t i = 0; i < models.size(); i++) {
-		models[i].reserve(gltf.meshes[i].primitives.size());
-		for (auto& prim : gltf.meshes[i].primitives) {
-			if (!prim.attributes.position.has_value())
-				continue;
-			size_t count = gltf.accessors[prim.attributes.position.value()].count;
-			bool has_position = prim.attributes.position.has_value();
-			bool has_normal = prim.attributes.normal.has_value();
-			bool has_tangent = prim.attributes.tangent.has_value();
-			size_t num_uv = prim.attributes.texcoord.size();
-			size_t num_colour = prim.attributes.color.size();
-			StandardMesh mesh(
-				count,
-				{has_position, has_normal, has_tangent, has_tangent, num_uv > 0, num_uv > 1, num_uv > 2, num_uv > 3,
-				 num_colour > 0, num_colour > 1});
-			accessor_for_each(
-				gltf, buffers_data, prim.attributes.position.value(), [&mesh](size_t vertex, const void* data) {
-					mesh.position(vertex) = *reinterpret_cast<const glm::vec3*>(data);
-				});
-
-			if (prim.attributes.normal.has_value()) {
-				accessor_for_each(
-					gltf, buffers_data, prim.attributes.normal.value(), [&mesh](size_t vertex, const void* data) {
-						mesh.normal(vertex) = *reinterpret_cast<const glm::vec3*>(data);
-					});
-			}
-
-			if (prim.attributes.tangent.has_value()) {
-				accessor_for_each(
-					gltf, buffers_data, prim.attributes.tangent.value(), [&mesh](size_t vertex, const void* data) {
-						const vec3& tangent = *reinterpret_cast<const glm::vec3*>(data);
-						const float& sign =
-							*reinterpret_cast<const float*>(reinterpret_cast<const glm::vec3*>(data) + 1);
-						mesh.tangent(vertex) = tangent;
-						mesh.bitangent(vertex) = (sign * cross(mesh.normal(vertex), tangent));
-					});
-			}
-
-			for (size_t t = 0; t < prim.attributes.texcoord.size(); t++) {
-				static const std::unordered_map<Gltf::ComponentType, std::function<vec2(const void*)>> convert_funcs = {
-					{Gltf::ComponentType::FLOAT, [](const void* data) { return *reinterpret_cast<const vec2*>(data); }},
-					{Gltf::ComponentType::UNSIGNED_BYTE,
-					 [](const void* data) { return unpackUnorm2x8(*reinterpret_cast<const uint16*>(data)); }},
-					{Gltf::ComponentType::UNSIGNED_SHORT,
-					 [](const void* data) { return unpackUnorm2x16(*reinterpret_cast<const uint32*>(data)); }}};
-
-				const Gltf::Accessor& accessor = gltf.accessors[prim.attributes.texcoord[t]];
-				const std::function<vec2(const void*)> convert_func = convert_funcs.at(accessor.componentType);
-				accessor_for_each(
-					gltf, buffers_data, prim.attributes.texcoord[t],
-					[&mesh, convert_func, t](size_t index, const void* data) {
-						mesh.tex_coord(t, index) = convert_func(data);
-					});
+	// Primitives are decoded on the jobs, only creating the meshes needs this thread
+	std::vector<std::pair<size_t, size_t>> primitives;
+	for (size_t i = 0; i < gltf.meshes.size(); i++)
+		for (size_t p = 0; p < gltf.meshes[i].primitives.size(); p++)
+			if (gltf.meshes[i].primitives[p].attributes.position.has_value())
+				primitives.push_back({i, p});
+	std::vector<std::optional<StandardMesh>> decoded(primitives.size());
+	render.job_system().parallel_for(
+		primitives.size(), 1,
+		[&](size_t begin, size_t end) {
+			for (size_t p = begin; p < end; p++) {
+				auto [i, primitive] = primitives[p];
+				decoded[p] = decode_primitive(gltf, buffers_data, gltf.meshes[i].primitives[primitive]);
 			}
+		},
+		"Decode glTF primitive");
 
-			for (size_t c = 0; c < prim.attributes.color.size(); c++) {
-				static const std::unordered_map<
-					Gltf::Accessor::Type, std::unordered_map<Gltf::ComponentType, std::function<vec4(const void*)>>>
-					convert_funcs = {
-						{Gltf::Accessor::Type::VEC4,
-						 {
-							 {Gltf::ComponentType::FLOAT,
-							  [](const void* data) { return *reinterpret_cast<const vec4*>(data); }},
-							 {Gltf::ComponentType::UNSIGNED_BYTE,
-							  [](const void* data) { return unpackUnorm4x8(*reinterpret_cast<const uint32*>(data)); }},
-							 {Gltf::ComponentType::UNSIGNED_SHORT,
-							  [](const void* data) { return unpackUnorm4x16(*reinterpret_cast<const uint64*>(data)); }},
-						 }},
-						{Gltf::Accessor::Type::VEC3,
-						 {
-							 {Gltf::ComponentType::FLOAT,
-							  [](const void* data) { return vec4(*reinterpret_cast<const vec3*>(data), 1.0); }},
-							 {Gltf::ComponentType::UNSIGNED_BYTE,
-							  [](const void* data) {
-								  return vec4((vec3(*reinterpret_cast<const u8vec3*>(data)) / 255.0f), 1.0f);
-							  }},
-							 {Gltf::ComponentType::UNSIGNED_SHORT,
-							  [](const void* data) {
-								  return vec4((vec3(*reinterpret_cast<const u16vec3*>(data)) / 65535.0f), 1.0f);
-							  }},
-						 }}};
-
-				const Gltf::Accessor& accessor = gltf.accessors[prim.attributes.color[c]];
-				const std::function<vec4(const void*)> convert_func =
-					convert_funcs.at(accessor.type).at(accessor.componentType);
-				accessor_for_each(
-					gltf, buffers_data, prim.indices.value(), [&mesh, convert_func, c](size_t index, const void* data) {
-						mesh.colour(c, index) = convert_func(data);
-					});
-			}
-
-			if (prim.indices.has_value()) {
-				static const std::unordered_map<Gltf::ComponentType, std::function<uint32(const void*)>> convert_funcs =
-					{{Gltf::ComponentType::UNSIGNED_BYTE,
-					  [](const void* data) { return *reinterpret_cast<const uint8*>(data); }},
-					 {Gltf::ComponentType::UNSIGNED_SHORT,
-					  [](const void* data) { return *reinterpret_cast<const uint16*>(data); }},
-					 {Gltf::ComponentType::UNSIGNED_INT,
-					  [](const void* data) { return *reinterpret_cast<const uint32*>(data); }}};
-
-				const Gltf::Accessor& accessor = gltf.accessors[prim.indices.value()];
-				mesh.indices.resize(accessor.count);
-				const std::function<uint32_t(const void*)> convert_func = convert_funcs.at(accessor.componentType);
-				accessor_for_each(
-					gltf, buffers_data, prim.indices.value(), [&mesh, convert_func](size_t index, const void* data) {
-						mesh.indices[index] = convert_func(data);
-					});
-			}
-
-			MaterialHandle material = default_material;
-			if (prim.material.has_value())
-				material = materials.at(prim.material.value());
-
-			models[i].push_back(Model::Surface{.mesh = render.standard_mesh_create(mesh), .material = material});
-		}
+	std::vector<std::vector<Model::Surface>> models;
+	models.resize(gltf.meshes.size());
+	for (size_t p = 0; p < primitives.size(); p++) {
+		auto [i, primitive] = primitives[p];
+		auto& prim = gltf.meshes[i].primitives[primitive];
+		MaterialHandle material = default_material;
+		if (prim.material.has_value())
+			material = materials.at(prim.material.value());
+
+		models[i].push_back(
+			Model::Surface{.mesh = render.standard_mesh_create(std::move(*decoded[p])), .material = material});
 	}
 
-	Model model{.render = render, .surfaces = {}};
+	Model model{.render = render, .nodes = {}, .surfaces = {}};
 
 	if (gltf.scene.has_value())
-		crawl_nodes(gltf, gltf.scenes[gltf.scene.value()].nodes, model.surfaces, models);
+		crawl_nodes(gltf, gltf.scenes[gltf.scene.value()].nodes, model, models);
 
 	return model;
 }
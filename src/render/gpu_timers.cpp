@@ -0,0 +1,71 @@
+#include "gpu_timers.hpp"
+
+#include <algorithm>
+
+#include "gl.hpp"
+
+namespace Render {
+
+void GpuTimers::begin(const std::string& name) {
+	auto section = std::find_if(sections.begin(), sections.end(), [&](Section& s) { return s.name == name; });
+	if (section == sections.end()) {
+		sections.push_back(Section{.name = name});
+		section = sections.end() - 1;
+		glCreateQueries(GL_TIME_ELAPSED, frames, section->queries.data());
+	}
+
+	GLuint query = section->queries[frame];
+	if (section->pending[frame]) {
+		GLuint64 elapsed;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+		section->ms = elapsed / 1e6;
+		section->measured = true;
+	}
+
+	glBeginQuery(GL_TIME_ELAPSED, query);
+	section->pending[frame] = true;
+	active = true;
+}
+
+void GpuTimers::end() {
+	if (active)
+		glEndQuery(GL_TIME_ELAPSED);
+	active = false;
+}
+
+void GpuTimers::end_frame() {
+	frame = (frame + 1) % frames;
+
+	// Collect results without waiting, so sections that are not timed every frame (skybox updates) still report
+	for (auto& section : sections) {
+		for (int i = 0; i < frames; i++) {
+			if (!section.pending[i])
+				continue;
+			GLuint available;
+			glGetQueryObjectuiv(section.queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available) {
+				GLuint64 elapsed;
+				glGetQueryObjectui64v(section.queries[i], GL_QUERY_RESULT, &elapsed);
+				section.ms = elapsed / 1e6;
+				section.measured = true;
+				section.pending[i] = false;
+			}
+		}
+	}
+}
+
+std::vector<GpuTimers::Timing> GpuTimers::timings() const {
+	std::vector<Timing> timings;
+	for (auto& section : sections)
+		timings.push_back({section.name, section.ms});
+	return timings;
+}
+
+std::optional<double> GpuTimers::last(const std::string& name) const {
+	for (auto& section : sections)
+		if (section.name == name && section.measured)
+			return section.ms;
+	return {};
+}
+
+} // namespace Render
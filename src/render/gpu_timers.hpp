@@ -0,0 +1,45 @@
+#pragma once
+
+#include <array>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace Render {
+
+// Named GPU time-elapsed queries, read back a few frames late so they never stall
+class GpuTimers {
+	typedef unsigned int GLuint;
+
+	static const int frames = 3;
+
+	struct Section {
+		std::string name;
+		std::array<GLuint, frames> queries = {};
+		std::array<bool, frames> pending = {};
+		double ms = 0;
+		bool measured = false;
+	};
+	std::vector<Section> sections;
+	int frame = 0;
+	bool active = false;
+
+  public:
+	GpuTimers() {}
+	GpuTimers(const GpuTimers&) = delete;
+
+	void begin(const std::string& name);
+	void end();
+	void end_frame();
+
+	// A copy, so it stays valid while sections are added
+	struct Timing {
+		std::string name;
+		double ms;
+	};
+	std::vector<Timing> timings() const;
+	// Most recent result for a section, if one has come back yet
+	std::optional<double> last(const std::string& name) const;
+};
+
+} // namespace Render
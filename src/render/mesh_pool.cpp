@@ -0,0 +1,95 @@
+#include "mesh_pool.hpp"
+
+#include <algorithm>
+
+#include "gl.hpp"
+
+namespace Render {
+
+size_t MeshPool::Arena::allocate(size_t count) {
+	if (count == 0)
+		return 0;
+	for (auto it = free.begin(); it != free.end(); it++) {
+		if (it->size < count)
+			continue;
+		size_t offset = it->offset;
+		it->offset += count;
+		it->size -= count;
+		if (it->size == 0)
+			free.erase(it);
+		return offset;
+	}
+
+	size_t newCapacity = std::max<size_t>(capacity * 2, 1 << 16);
+	while (newCapacity < capacity + count)
+		newCapacity *= 2;
+
+	GLuint newBuffer;
+	glCreateBuffers(1, &newBuffer);
+	glNamedBufferStorage(newBuffer, newCapacity * stride, nullptr, GL_DYNAMIC_STORAGE_BIT);
+	if (capacity > 0) {
+		glCopyNamedBufferSubData(buffer, newBuffer, 0, 0, capacity * stride);
+		glDeleteBuffers(1, &buffer);
+	}
+	buffer = newBuffer;
+
+	release(capacity, newCapacity - capacity);
+	capacity = newCapacity;
+	return allocate(count);
+}
+
+void MeshPool::Arena::release(size_t offset, size_t count) {
+	if (count == 0)
+		return;
+	// Kept sorted by offset, merging with the neighbouring blocks
+	auto next = std::lower_bound(
+		free.begin(), free.end(), offset, [](const Block& block, size_t offset) { return block.offset < offset; });
+	next = free.insert(next, {offset, count});
+	if (next + 1 != free.end() && next->offset + next->size == (next + 1)->offset) {
+		next->size += (next + 1)->size;
+		free.erase(next + 1);
+	}
+	if (next != free.begin() && (next - 1)->offset + (next - 1)->size == next->offset) {
+		(next - 1)->size += next->size;
+		free.erase(next);
+	}
+}
+
+void MeshPool::init() {
+	glCreateVertexArrays(1, &vertexArray);
+	const GLint sizes[] = {3, 3, 3, 3, 2};
+	GLuint offset = 0;
+	for (GLuint attrib = 0; attrib < std::size(sizes); attrib++) {
+		glEnableVertexArrayAttrib(vertexArray, attrib);
+		glVertexArrayAttribFormat(vertexArray, attrib, sizes[attrib], GL_FLOAT, false, offset * sizeof(float));
+		glVertexArrayAttribBinding(vertexArray, attrib, 0);
+		offset += sizes[attrib];
+	}
+}
+
+MeshPool::Range MeshPool::allocate(const std::vector<float>& vertexData, const std::vector<uint32_t>& indexData) {
+	GLuint oldVertexBuffer = vertices.buffer, oldIndexBuffer = indices.buffer;
+
+	Range range;
+	range.vertexCount = vertexData.size() / vertexFloats;
+	range.indexCount = indexData.size();
+	range.baseVertex = vertices.allocate(range.vertexCount);
+	range.firstIndex = indices.allocate(range.indexCount);
+	glNamedBufferSubData(
+		vertices.buffer, range.baseVertex * vertices.stride, vertexData.size() * sizeof(float), vertexData.data());
+	glNamedBufferSubData(
+		indices.buffer, range.firstIndex * indices.stride, indexData.size() * sizeof(uint32_t), indexData.data());
+
+	if (vertices.buffer != oldVertexBuffer)
+		glVertexArrayVertexBuffer(vertexArray, 0, vertices.buffer, 0, vertices.stride);
+	if (indices.buffer != oldIndexBuffer)
+		glVertexArrayElementBuffer(vertexArray, indices.buffer);
+	return range;
+}
+
+void MeshPool::release(const Range& range) {
+	vertices.release(range.baseVertex, range.vertexCount);
+	indices.release(range.firstIndex, range.indexCount);
+}
+
+} // namespace Render
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Render {
+
+// Vertices and indices of every mesh in two shared buffers behind one vertex array, so any set of surfaces can be
+// drawn by a single multi-draw. Vertices are interleaved in one fixed layout, attributes a mesh lacks are zero
+class MeshPool {
+	typedef unsigned int GLuint;
+	typedef int GLint;
+
+  public:
+	// position, normal, tangent, bitangent, tex_coord_0
+	static const size_t vertexFloats = 14;
+
+	struct Range {
+		GLuint firstIndex = 0;
+		GLuint indexCount = 0;
+		GLint baseVertex = 0;
+		GLuint vertexCount = 0;
+	};
+
+  private:
+	// First fit sub-allocation of a buffer that doubles when full
+	struct Arena {
+		GLuint buffer = 0;
+		size_t stride;
+		size_t capacity = 0;
+		struct Block {
+			size_t offset, size;
+		};
+		std::vector<Block> free = {};
+
+		size_t allocate(size_t count);
+		void release(size_t offset, size_t count);
+	};
+	Arena vertices = {.stride = vertexFloats * sizeof(float)};
+	Arena indices = {.stride = sizeof(uint32_t)};
+	GLuint vertexArray = 0;
+
+  public:
+	MeshPool() {}
+	MeshPool(const MeshPool&) = delete;
+
+	void init();
+
+	Range allocate(const std::vector<float>& vertexData, const std::vector<uint32_t>& indexData);
+	void release(const Range& range);
+
+	GLuint vao() const { return vertexArray; }
+};
+
+} // namespace Render
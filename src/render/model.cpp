@@ -1,27 +1,43 @@
 #include "model.hpp"
 
-#include <algorithm>
-
 namespace Render {
 
 ModelInstance::ModelInstance(Model group, mat4 transform) : render(group.render) {
-	instances.resize(group.surfaces.size());
-	std::transform(group.surfaces.begin(), group.surfaces.end(), instances.begin(), [this](Model::Surface surface) {
-		return Instance{render.surface_create(surface.mesh, surface.material), surface.transform};
-	});
-	setTransform(transform);
+	root = render.transform_node_create(transform);
+	nodes.reserve(group.nodes.size());
+	for (auto& node : group.nodes)
+		nodes.push_back(render.transform_node_create(node.parent ? nodes[*node.parent] : root, node.transform));
+
+	surfaces.reserve(group.surfaces.size());
+	for (auto& surface : group.surfaces) {
+		surfaces.push_back(render.surface_create(surface.mesh, surface.material));
+		render.surface_set_node(surfaces.back(), surface.node ? nodes[*surface.node] : root);
+	}
 }
 
 ModelInstance::~ModelInstance() {
-	for (auto& i : instances) {
-		render.surface_delete(std::move(i.handle));
+	for (auto& surface : surfaces) {
+		render.surface_delete(std::move(surface));
 	}
+	// Children first, so none are moved up to a parent about to go too
+	for (auto node = nodes.rbegin(); node != nodes.rend(); node++) {
+		render.transform_node_delete(std::move(*node));
+	}
+	render.transform_node_delete(std::move(root));
 }
 
-void ModelInstance::setTransform(mat4 transform) {
-	for (auto& i : instances) {
-		render.surface_set_transform(i.handle, transform * i.baseTrans);
-	}
+void ModelInstance::setTransform(mat4 transform) { render.transform_node_set_local(root, transform); }
+
+void ModelInstance::setNodeTransform(size_t node, mat4 transform) {
+	render.transform_node_set_local(nodes.at(node), transform);
+}
+
+void ModelInstance::setTransform(SceneSnapshot::Transforms& snapshot, mat4 transform) {
+	snapshot.transform_node_set_local(root, transform);
+}
+
+void ModelInstance::setNodeTransform(SceneSnapshot::Transforms& snapshot, size_t node, mat4 transform) {
+	snapshot.transform_node_set_local(nodes.at(node), transform);
 }
 
-} // namespace Render
\ No newline at end of file
+} // namespace Render
@@ -1,15 +1,24 @@
 #pragma once
 
 #include "render.hpp"
+#include "scene_snapshot.hpp"
 
 namespace Render {
 struct Model {
 	Core& render;
 
+	// Parents come before their children
+	struct Node {
+		std::optional<size_t> parent;
+		mat4 transform = mat4(1.0f);
+	};
+	std::vector<Node> nodes;
+
 	struct Surface {
 		MeshHandle mesh;
 		MaterialHandle material;
-		mat4 transform = mat4(1.0f);
+		// Surfaces without a node sit at the model's origin
+		std::optional<size_t> node;
 	};
 	std::vector<Surface> surfaces;
 };
@@ -18,11 +27,10 @@ class ModelInstance {
   private:
 	Core& render;
 
-	struct Instance {
-		SurfaceHandle handle;
-		mat4 baseTrans;
-	};
-	std::vector<Instance> instances;
+	// The model's nodes hang off root, which carries the instance's transform
+	TransformNodeHandle root;
+	std::vector<TransformNodeHandle> nodes;
+	std::vector<SurfaceHandle> surfaces;
 
   public:
 	ModelInstance(Model group) : ModelInstance(group, mat4(1.0f)) {}
@@ -32,6 +40,11 @@ class ModelInstance {
 	ModelInstance(ModelInstance&) = delete;
 
 	void setTransform(mat4);
+	// Moves one of the model's nodes relative to its parent
+	void setNodeTransform(size_t node, mat4);
+	// The same, recorded for the renderer's thread to apply
+	void setTransform(SceneSnapshot::Transforms&, mat4);
+	void setNodeTransform(SceneSnapshot::Transforms&, size_t node, mat4);
 };
 
 } // namespace Render
@@ -1,5 +1,9 @@
 #include "render.hpp"
 
+#include <bit>
+#include <chrono>
+#include <cstring>
+#include <limits>
 #include <string>
 
 #include "gl.hpp"
@@ -7,109 +11,225 @@
 
 namespace Render {
 
-struct SprivStage {
-	const std::vector<uint32_t>& data;
-	GLenum shaderType;
-	std::string entryPoint = "main";
-};
+GLuint Render::load_spirv_program(const std::vector<SprivStage> stages) {
+	uint64_t key = hash_bytes(nullptr, 0);
+	for (auto& stage : stages) {
+		key = hash_vector(stage.data, key);
+		key = hash_bytes(&stage.shaderType, sizeof(stage.shaderType), key);
+		key = hash_bytes(stage.entryPoint.data(), stage.entryPoint.size(), key);
+		key = hash_vector(stage.constants, key);
+	}
+	if (auto program = programCache.load(key))
+		return program.value();
+
+	auto start = std::chrono::high_resolution_clock::now();
 
-GLuint load_spirv_program(const std::vector<SprivStage> stages) {
 	GLuint program = glCreateProgram();
+	if (programCache.enabled())
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 
 	for (auto& stage : stages) {
+		std::vector<GLuint> constantIndex, constantValue;
+		for (auto [index, value] : stage.constants) {
+			constantIndex.push_back(index);
+			constantValue.push_back(value);
+		}
+
 		GLuint shader = glCreateShader(stage.shaderType);
 		glShaderBinary(
 			1, &shader, GL_SHADER_BINARY_FORMAT_SPIR_V, stage.data.data(), stage.data.size() * sizeof(uint32_t));
-		glSpecializeShader(shader, stage.entryPoint.c_str(), 0, nullptr, nullptr);
+		glSpecializeShader(
+			shader, stage.entryPoint.c_str(), stage.constants.size(), constantIndex.data(), constantValue.data());
 		glAttachShader(program, shader);
 	}
 
 	glLinkProgram(program);
 
+	programCache.stats.misses++;
+	programCache.stats.link_ms +=
+		std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	GLint status;
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (status)
+		programCache.store(key, program);
+
 	return program;
 }
 
-struct PBR {
+struct Render::PBR {
 	vec4 albedoFactor;
 	vec3 emissiveFactor;
 	float metalFactor;
 	float roughFactor;
 	float reflectionLevels;
-	uint has_albedo_texture;
-	uint has_metal_rough_texture;
-	uint has_normal_texture;
-	uint has_occlusion_texture;
-	uint has_emissive_texture;
 	float alpha_depth_cutoff;
 };
-MaterialHandle Render::create_pbr_material(MaterialPBR pbr) {
-	static ShaderHandle shader = shaders_insert(Shader{
-		load_spirv_program({{Shaders::default_vert, GL_VERTEX_SHADER}, {Shaders::pbr_frag, GL_FRAGMENT_SHADER}}),
-		Shader::Type::Opaque});
-	static ShaderHandle trans_shader = shaders_insert(Shader{
-		load_spirv_program({{Shaders::default_vert, GL_VERTEX_SHADER}, {Shaders::pbr_frag, GL_FRAGMENT_SHADER}}),
-		Shader::Type::Transparent});
+
+// Feature bits double as the specialization constant ids in pbr.frag and cutoff_depth.frag
+enum PBRFeatures : uint32_t {
+	AlbedoTexture = 1 << 0,
+	MetalRoughTexture = 1 << 1,
+	NormalTexture = 1 << 2,
+	OcclusionTexture = 1 << 3,
+	EmissiveTexture = 1 << 4,
+	PBRFeatureCount = 5,
+};
+
+ShaderHandle Render::pbr_shader(PBRVariant variant, uint32_t features) {
+	// cutoff_depth.frag only samples albedo
+	GLuint featureCount = PBRFeatures::PBRFeatureCount;
+	if (variant == PBRVariant::CutoffDepth) {
+		features &= PBRFeatures::AlbedoTexture;
+		featureCount = 1;
+	}
+
+	uint32_t key = (features << 2) | static_cast<uint32_t>(variant);
+	auto shader = pbr_shaders.find(key);
+	if (shader != pbr_shaders.end())
+		return shader->second;
+
+	std::vector<std::pair<GLuint, GLuint>> constants;
+	for (GLuint i = 0; i < featureCount; i++)
+		constants.push_back({i, (features >> i) & 1});
+
+	GLuint program;
+	Shader::Type type;
+	switch (variant) {
+	case PBRVariant::Opaque:
+	case PBRVariant::Transparent:
+		program = load_spirv_program(
+			{{Shaders::default_vert, GL_VERTEX_SHADER},
+			 {Shaders::pbr_frag, GL_FRAGMENT_SHADER, "main", constants}});
+		type = variant == PBRVariant::Opaque ? Shader::Type::Opaque : Shader::Type::Transparent;
+		break;
+	case PBRVariant::CutoffDepth:
+		program = load_spirv_program(
+			{{Shaders::default_vert, GL_VERTEX_SHADER},
+			 {Shaders::cutoff_depth_frag, GL_FRAGMENT_SHADER, "main", constants}});
+		type = Shader::Type::Depth | Shader::Type::Shadow;
+		break;
+	}
+	return pbr_shaders.emplace(key, shaders_insert(Shader{program, type})).first->second;
+}
+
+std::vector<Core::Material::ShaderPass> Render::pbr_shader_passes(const MaterialPBR& pbr) {
 	static ShaderHandle depthShader = shaders_insert(Shader{
 		load_spirv_program({{Shaders::default_vert, GL_VERTEX_SHADER}, {Shaders::depth_frag, GL_FRAGMENT_SHADER}}),
 		Shader::Type::Depth | Shader::Type::Shadow});
-	static ShaderHandle cutoffDepthShader = shaders_insert(Shader{
-		load_spirv_program(
-			{{Shaders::default_vert, GL_VERTEX_SHADER}, {Shaders::cutoff_depth_frag, GL_FRAGMENT_SHADER}}),
-		Shader::Type::Depth | Shader::Type::Shadow});
-
-	GLuint uniform;
-	glCreateBuffers(1, &uniform);
-	PBR _pbr = {
-		.albedoFactor = pbr.albedoFactor,
-		.emissiveFactor = pbr.emissiveFactor,
-		.metalFactor = pbr.metalFactor,
-		.roughFactor = pbr.roughFactor,
-		.reflectionLevels = static_cast<float>(reflectionLevels),
-		.has_albedo_texture = pbr.albedoTexture.has_value(),
-		.has_metal_rough_texture = pbr.metalRoughTexture.has_value(),
-		.has_normal_texture = pbr.normalTexture.has_value(),
-		.has_occlusion_texture = pbr.occlusionTexture.has_value(),
-		.has_emissive_texture = pbr.emissiveTexture.has_value(),
-		.alpha_depth_cutoff = pbr.alphaCutoff,
-	};
-	glNamedBufferStorage(uniform, sizeof(PBR), &_pbr, 0);
 
-	std::vector<TextureHandle> textures = {
-		irradiance,
-		reflection,
-		reflectionBRDF,
+	uint32_t features = 0;
+	if (pbr.albedoTexture.has_value())
+		features |= PBRFeatures::AlbedoTexture;
+	if (pbr.metalRoughTexture.has_value())
+		features |= PBRFeatures::MetalRoughTexture;
+	if (pbr.normalTexture.has_value())
+		features |= PBRFeatures::NormalTexture;
+	if (pbr.occlusionTexture.has_value())
+		features |= PBRFeatures::OcclusionTexture;
+	if (pbr.emissiveTexture.has_value())
+		features |= PBRFeatures::EmissiveTexture;
+
+	size_t textures = texture_set({
 		pbr.albedoTexture.value_or(0),
 		pbr.metalRoughTexture.value_or(0),
 		pbr.normalTexture.value_or(0),
 		pbr.occlusionTexture.value_or(0),
-		pbr.emissiveTexture.value_or(0)};
+		pbr.emissiveTexture.value_or(0),
+	});
 
 	switch (pbr.alphaMode) {
 	case MaterialPBR::AlphaMode::Opaque:
-		return materials_insert(Material{{
-			{.shader = shader, .uniform = uniform, .textures = textures},
-			{.shader = depthShader, .uniform = 0, .textures = {}},
-		}});
+		return {{.shader = pbr_shader(PBRVariant::Opaque, features), .textures = textures}, {.shader = depthShader}};
 	case MaterialPBR::AlphaMode::Masked:
-		return materials_insert(Material{{
-			{.shader = shader, .uniform = uniform, .textures = textures},
-			{.shader = cutoffDepthShader, .uniform = uniform, .textures = {pbr.albedoTexture.value_or(0)}},
-		}});
+		return {
+			{.shader = pbr_shader(PBRVariant::Opaque, features), .textures = textures},
+			{.shader = pbr_shader(PBRVariant::CutoffDepth, features),
+			 .textures = texture_set({pbr.albedoTexture.value_or(0)})},
+		};
 	case MaterialPBR::AlphaMode::Blend:
-		return materials_insert(Material{{
-			{.shader = trans_shader, .uniform = uniform, .textures = textures},
-		}});
+		return {{.shader = pbr_shader(PBRVariant::Transparent, features), .textures = textures}};
 	}
+	return {};
 }
 
-Render::Render(void (*glGetProcAddr(const char*))()) : Core(glGetProcAddr) {
+Render::PBR Render::pbr_params(const MaterialPBR& pbr) {
+	return PBR{
+		.albedoFactor = pbr.albedoFactor,
+		.emissiveFactor = pbr.emissiveFactor,
+		.metalFactor = pbr.metalFactor,
+		.roughFactor = pbr.roughFactor,
+		.reflectionLevels = static_cast<float>(reflectionLevels),
+		.alpha_depth_cutoff = pbr.alphaCutoff,
+	};
+}
+
+MaterialHandle Render::create_pbr_material(MaterialPBR pbr) {
+	MaterialHandle material = materials_insert(Material{pbr_shader_passes(pbr)});
+	material_set_params(material, pbr_params(pbr));
+	return material;
+}
+
+void Render::update_pbr_material(MaterialHandle& material, MaterialPBR pbr) {
+	material_set_shader_passes(material, pbr_shader_passes(pbr));
+	material_set_params(material, pbr_params(pbr));
+}
+
+struct IBLCacheHeader {
+	uint32_t magic;
+	uint32_t size;
+	uint64_t key;
+};
+const uint32_t iblCacheMagic = 0x4c42494d;
+
+static std::filesystem::path ibl_cache_path(const char* kind, uint64_t key) {
+	auto directory = cache_directory() / "ibl";
+	std::error_code error;
+	std::filesystem::create_directories(directory, error);
+	char name[48];
+	std::snprintf(name, sizeof(name), "%s_%016llx.bin", kind, static_cast<unsigned long long>(key));
+	return directory / name;
+}
+
+// Half-float texel data (and the SH coefficients) behind a small header; Entries of the wrong size are ignored
+static std::optional<std::vector<char>> read_ibl_cache(const char* kind, uint64_t key, size_t size) {
+	auto data = read_file(ibl_cache_path(kind, key));
+	IBLCacheHeader header;
+	if (!data || data->size() != sizeof(header) + size)
+		return {};
+	std::memcpy(&header, data->data(), sizeof(header));
+	if (header.magic != iblCacheMagic || header.size != size || header.key != key)
+		return {};
+	data->erase(data->begin(), data->begin() + sizeof(header));
+	return data;
+}
+
+static void write_ibl_cache(const char* kind, uint64_t key, const std::vector<char>& payload) {
+	IBLCacheHeader header = {.magic = iblCacheMagic, .size = static_cast<uint32_t>(payload.size()), .key = key};
+	std::vector<char> data(sizeof(header));
+	std::memcpy(data.data(), &header, sizeof(header));
+	data.insert(data.end(), payload.begin(), payload.end());
+	write_file(ibl_cache_path(kind, key), data);
+}
+
+Render::Render(void (*glGetProcAddr(const char*))(), JobSystem& jobs) : Core(glGetProcAddr, jobs) {
+	programCache.init();
+
+	GLint extensions;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &extensions);
+	for (GLint i = 0; i < extensions; i++) {
+		auto name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+		if (std::strcmp(name, "GL_ARB_shader_viewport_layer_array") == 0)
+			layerFromVertex = true;
+	}
+
+	lightClusterProgram = load_spirv_program({{Shaders::light_cluster_comp, GL_COMPUTE_SHADER}});
+	cullDrawsProgram = load_spirv_program({{Shaders::cull_draws_comp, GL_COMPUTE_SHADER}});
+	hizInitProgram = load_spirv_program({{Shaders::hiz_init_comp, GL_COMPUTE_SHADER}});
+	hizDownsampleProgram = load_spirv_program({{Shaders::hiz_downsample_comp, GL_COMPUTE_SHADER}});
+
 	{
-		ShaderHandle skyboxShader = shaders_insert(Shader{
-			load_spirv_program(
-				{{Shaders::skybox_vert, GL_VERTEX_SHADER}, {Shaders::test_skybox_frag, GL_FRAGMENT_SHADER}}),
-			Shader::Type::Opaque | Shader::Type::Skybox});
-		MaterialHandle skyboxMaterial =
-			materials_insert(Material{{{.shader = skyboxShader, .uniform = 0, .textures = {}}}});
+		MaterialHandle skyboxMaterial = materials_insert(Material{skybox_shader_passes(Shaders::test_skybox_frag)});
 
 		std::vector<vec3> verticies = {
 			{-1, -1, -1}, {-1, -1, 1}, {-1, 1, -1}, {-1, 1, 1}, {1, -1, -1}, {1, -1, 1}, {1, 1, -1}, {1, 1, 1},
@@ -126,41 +246,45 @@ Render::Render(void (*glGetProcAddr(const char*))()) : Core(glGetProcAddr) {
 	};
 		// clang-format on
 
-		GLuint vertex_buffer, index_buffer, vao;
-		glCreateBuffers(1, &vertex_buffer);
-		glCreateBuffers(1, &index_buffer);
-		glCreateVertexArrays(1, &vao);
-
-		glNamedBufferStorage(vertex_buffer, vector_size(verticies), verticies.data(), 0);
-		glNamedBufferStorage(index_buffer, vector_size(indicies), indicies.data(), 0);
-
-		glVertexArrayVertexBuffer(vao, 0, vertex_buffer, 0, sizeof(vec3));
-		glEnableVertexArrayAttrib(vao, 0);
-		glVertexArrayAttribFormat(vao, 0, 3, GL_FLOAT, false, 0);
+		std::vector<float> vertexData(verticies.size() * MeshPool::vertexFloats);
+		for (size_t i = 0; i < verticies.size(); i++)
+			std::copy_n(&verticies[i].x, 3, vertexData.begin() + i * MeshPool::vertexFloats);
 
-		glVertexArrayElementBuffer(vao, index_buffer);
-
-		MeshHandle skyboxMesh = meshes_insert(
-			Mesh{.vao = vao, .count = static_cast<int32_t>(indicies.size()), .buffers = {vertex_buffer, index_buffer}});
+		MeshHandle skyboxMesh = mesh_create(vertexData, indicies, AABB{});
 		skybox = surface_create(skyboxMesh, skyboxMaterial);
 	}
 
-	glCreateTextures(GL_TEXTURE_CUBE_MAP, 1, &skyboxCubemap);
-	glTextureStorage2D(skyboxCubemap, 1, GL_RGB16F, skyboxSize, skyboxSize);
+	glCreateBuffers(2, irradianceSH.data());
+	for (GLuint buffer : irradianceSH)
+		glNamedBufferStorage(buffer, sizeof(vec4) * 9, nullptr, GL_DYNAMIC_STORAGE_BIT);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, irradianceSH[iblFront]);
 
-	glCreateTextures(GL_TEXTURE_CUBE_MAP, 1, &irradiance);
-	glTextureStorage2D(irradiance, 1, GL_RGB16F, irradianceSize, irradianceSize);
+	{
+		int groups = irradianceSampleSize / 8;
+		glCreateBuffers(1, &irradiancePartials);
+		glNamedBufferStorage(irradiancePartials, sizeof(vec4) * 9 * groups * groups * 6, nullptr, 0);
+	}
 
-	glCreateTextures(GL_TEXTURE_CUBE_MAP, 1, &reflection);
-	glTextureStorage2D(reflection, reflectionLevels, GL_RGB16F, reflectionSize, reflectionSize);
-	glTextureParameteri(reflection, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glCreateTextures(GL_TEXTURE_CUBE_MAP, 2, reflection.data());
+	for (TextureHandle texture : reflection) {
+		glTextureStorage2D(texture, reflectionLevels, GL_RGB16F, reflectionSize, reflectionSize);
+		glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	}
 
 	glCreateTextures(GL_TEXTURE_2D, 1, &reflectionBRDF);
 	glTextureStorage2D(reflectionBRDF, 1, GL_RG16F, reflectionBRDFSize, reflectionBRDFSize);
 	glTextureParameteri(reflectionBRDF, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTextureParameteri(reflectionBRDF, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-	{
+	scene_textures = {reflection[iblFront], reflectionBRDF};
+
+	uint64_t brdfKey = hash_vector(Shaders::reflection_brdf_frag, hash_vector(Shaders::quad_vert));
+	brdfKey = hash_bytes(&reflectionBRDFSize, sizeof(reflectionBRDFSize), brdfKey);
+	const size_t brdfBytes = reflectionBRDFSize * reflectionBRDFSize * 2 * sizeof(uint16_t);
+	if (auto lut = read_ibl_cache("brdf", brdfKey, brdfBytes)) {
+		glTextureSubImage2D(
+			reflectionBRDF, 0, 0, 0, reflectionBRDFSize, reflectionBRDFSize, GL_RG, GL_HALF_FLOAT, lut->data());
+	} else {
 		GLuint framebuffer;
 		glCreateFramebuffers(1, &framebuffer);
 		glNamedFramebufferTexture(framebuffer, GL_COLOR_ATTACHMENT0, reflectionBRDF, 0);
@@ -206,13 +330,13 @@ Render::Render(void (*glGetProcAddr(const char*))()) : Core(glGetProcAddr) {
 		glDeleteBuffers(1, &vertex_buffer);
 		glDeleteBuffers(1, &index_buffer);
 		glDeleteVertexArrays(1, &quadVertexArray);
-	}
+		glDeleteFramebuffers(1, &framebuffer);
 
-	{
-		const float zero_block[4] = {0, 0, 0, 0};
-		glCreateBuffers(1, &zero_buffer);
-		glNamedBufferStorage(zero_buffer, sizeof(zero_block), zero_block, 0);
+		std::vector<char> data(brdfBytes);
+		glGetTextureImage(reflectionBRDF, 0, GL_RG, GL_HALF_FLOAT, data.size(), data.data());
+		write_ibl_cache("brdf", brdfKey, data);
 	}
+
 }
 
 const glm::mat4 captureViews[] = {
@@ -223,116 +347,301 @@ const glm::mat4 captureViews[] = {
 	glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, -1.0f, 0.0f)),
 	glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f))};
 
+void Render::bind_cube_cameras() {
+	struct {
+		mat4 proj;
+		mat4 views[6];
+	} cameras;
+	cameras.proj = infinitePerspective(glm::radians(90.0f), 1.0f, 0.1f);
+	std::copy(std::begin(captureViews), std::end(captureViews), cameras.views);
+
+	auto allocation = frameRing.push(cameras);
+	glBindBufferRange(GL_UNIFORM_BUFFER, 1, allocation.buffer, allocation.offset, allocation.size);
+}
+
+GLuint Render::load_layered_program(const std::vector<uint32_t>& fragment) {
+	if (layerFromVertex)
+		return load_spirv_program({{Shaders::skybox_layered_vert, GL_VERTEX_SHADER}, {fragment, GL_FRAGMENT_SHADER}});
+	return load_spirv_program(
+		{{Shaders::skybox_layered_gs_vert, GL_VERTEX_SHADER},
+		 {Shaders::layered_geom, GL_GEOMETRY_SHADER},
+		 {fragment, GL_FRAGMENT_SHADER}});
+}
+
+std::vector<Render::Material::ShaderPass> Render::skybox_shader_passes(const std::vector<uint32_t>& fragment) {
+	ShaderHandle display = shaders_insert(Shader{
+		load_spirv_program({{Shaders::skybox_vert, GL_VERTEX_SHADER}, {fragment, GL_FRAGMENT_SHADER}}),
+		Shader::Type::Opaque});
+	ShaderHandle capture = shaders_insert(Shader{load_layered_program(fragment), Shader::Type::Skybox});
+	return {{.shader = display}, {.shader = capture}};
+}
+
+void Render::size_skybox_cubemap() {
+	// A face spans 90 degrees; Until the window and camera exist assume 1080 pixels over 50 degrees
+	float pixelsPerRadian = height > 0 && fov > 0 ? height / fov : 1080 / glm::radians(50.0f);
+	int size = static_cast<int>(pixelsPerRadian * glm::half_pi<float>());
+	if (skyboxSourceSize > 0)
+		size = std::min(size, skyboxSourceSize);
+	size = std::bit_ceil(static_cast<unsigned>(std::max(size, reflectionSize)));
+
+	GLenum format = skyboxStorage.compact ? GL_R11F_G11F_B10F : GL_RGB16F;
+	size_t texelBytes = skyboxStorage.compact ? 4 : 6;
+	// The mip chain adds a third
+	while (size > reflectionSize && static_cast<size_t>(size) * size * 6 * texelBytes * 4 / 3 > skyboxStorage.budget)
+		size /= 2;
+
+	skyboxSize = size;
+	skyboxFormat = format;
+}
+
+// Only skybox surfaces are captured, and they are drawn at the far plane, so no depth buffer is needed
 void Render::render_cubemap(Shader::Type type, RenderOrder order, GLuint cubemap, GLsizei size) {
-	GLuint framebuffer, renderbuffer;
+	update_surface_buffer();
+
+	GLuint framebuffer;
 	glCreateFramebuffers(1, &framebuffer);
-	glCreateRenderbuffers(1, &renderbuffer);
-	glNamedRenderbufferStorage(renderbuffer, GL_DEPTH_COMPONENT24, size, size);
-	glNamedFramebufferRenderbuffer(framebuffer, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffer);
+	glNamedFramebufferTexture(framebuffer, GL_COLOR_ATTACHMENT0, cubemap, 0);
 
+	bind_cube_cameras();
 	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-	for (int i = 0; i < 6; i++) {
-		glNamedFramebufferTextureLayer(framebuffer, GL_COLOR_ATTACHMENT0, cubemap, 0, i);
-
-		Camera cam = {
-			.proj = infinitePerspective(glm::radians(90.0f), 1.0f, 0.1f),
-			.view = captureViews[i],
-			.camPos = vec3(0.0f)};
-		glNamedBufferSubData(cameraBuffer, 0, sizeof(Camera), &cam);
-
-		glViewport(0, 0, size, size);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		renderScene(type, order);
-	}
+	glViewport(0, 0, size, size);
+	glClear(GL_COLOR_BUFFER_BIT);
+	renderScene(type, order, 6);
+
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 	glDeleteFramebuffers(1, &framebuffer);
-	glDeleteRenderbuffers(1, &renderbuffer);
 }
 
-void Render::update_skybox() {
-	render_cubemap(Shader::Type::Skybox, RenderOrder::Shader, skyboxCubemap, skyboxSize);
+uint64_t Render::ibl_key(uint64_t source) {
+	// Not skyboxSize, which follows the display and the storage budget rather than what the results converge to
+	const int settings[] = {
+		static_cast<int>(skyboxFormat), irradianceSampleSize, reflectionSize, reflectionLevels, reflectionBaseSamples};
+	uint64_t key = hash_bytes(settings, sizeof(settings), source);
+	for (auto shader :
+		 {&Shaders::sh_project_comp, &Shaders::sh_reduce_comp, &Shaders::reflection_frag, &Shaders::skybox_layered_vert,
+		  &Shaders::skybox_layered_gs_vert, &Shaders::layered_geom})
+		key = hash_vector(*shader, key);
+	return key;
+}
 
-	GLuint framebuffer;
-	glCreateFramebuffers(1, &framebuffer);
-	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+static size_t reflection_level_bytes(int size) { return static_cast<size_t>(size) * size * 6 * 3 * sizeof(uint16_t); }
 
-	glBindVertexArray(meshes_get(surfaces_get(skybox).mesh).vao);
+bool Render::load_ibl(int index, uint64_t key) {
+	size_t size = sizeof(vec4) * 9;
+	for (int level = 0; level < reflectionLevels; level++)
+		size += reflection_level_bytes(reflectionSize >> level);
 
-	static GLuint irradianceShader =
-		load_spirv_program({{Shaders::skybox_vert, GL_VERTEX_SHADER}, {Shaders::irradiance_frag, GL_FRAGMENT_SHADER}});
-	glUseProgram(irradianceShader);
-	glBindTextures(1, 1, &skyboxCubemap);
+	auto data = read_ibl_cache("skybox", key, size);
+	if (!data)
+		return false;
 
-	for (int i = 0; i < 6; i++) {
-		glNamedFramebufferTextureLayer(framebuffer, GL_COLOR_ATTACHMENT0, irradiance, 0, i);
+	const char* cursor = data->data();
+	for (int level = 0; level < reflectionLevels; level++) {
+		int levelSize = reflectionSize >> level;
+		glTextureSubImage3D(reflection[index], level, 0, 0, 0, levelSize, levelSize, 6, GL_RGB, GL_HALF_FLOAT, cursor);
+		cursor += reflection_level_bytes(levelSize);
+	}
+	glNamedBufferSubData(irradianceSH[index], 0, sizeof(vec4) * 9, cursor);
+	return true;
+}
 
-		Camera cam = {
-			.proj = infinitePerspective(glm::radians(90.0f), 1.0f, 0.1f),
-			.view = captureViews[i],
-			.camPos = vec3(0.0f)};
-		glNamedBufferSubData(cameraBuffer, 0, sizeof(Camera), &cam);
+void Render::store_ibl(int index, uint64_t key) {
+	std::vector<char> data;
+	for (int level = 0; level < reflectionLevels; level++) {
+		size_t offset = data.size();
+		size_t bytes = reflection_level_bytes(reflectionSize >> level);
+		data.resize(offset + bytes);
+		glGetTextureImage(reflection[index], level, GL_RGB, GL_HALF_FLOAT, bytes, data.data() + offset);
+	}
+	size_t offset = data.size();
+	data.resize(offset + sizeof(vec4) * 9);
+	glGetNamedBufferSubData(irradianceSH[index], 0, sizeof(vec4) * 9, data.data() + offset);
+	write_ibl_cache("skybox", key, data);
+}
 
-		glViewport(0, 0, irradianceSize, irradianceSize);
-		glClear(GL_COLOR_BUFFER_BIT);
-		glDrawElements(GL_TRIANGLES, meshes_get(surfaces_get(skybox).mesh).count, GL_UNSIGNED_INT, 0);
+void Render::update_skybox() {
+	size_skybox_cubemap();
+
+	iblKey.reset();
+	if (skyboxKey)
+		iblKey = ibl_key(skyboxKey.value());
+	if (iblKey && load_ibl(1 - iblFront, iblKey.value())) {
+		swap_ibl();
+		return;
 	}
 
-	static GLuint reflectionShader =
-		load_spirv_program({{Shaders::skybox_vert, GL_VERTEX_SHADER}, {Shaders::reflection_frag, GL_FRAGMENT_SHADER}});
-	glUseProgram(reflectionShader);
-	glBindTextures(1, 1, &skyboxCubemap);
+	glDeleteTextures(1, &skyboxCubemap);
+	glCreateTextures(GL_TEXTURE_CUBE_MAP, 1, &skyboxCubemap);
+	glTextureStorage2D(
+		skyboxCubemap, std::bit_width(static_cast<unsigned>(skyboxSize)), skyboxFormat, skyboxSize, skyboxSize);
+	glTextureParameteri(skyboxCubemap, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 
-	for (int level = 0; level < reflectionLevels; level++) {
-		glUniform1f(1, static_cast<float>(level) / static_cast<float>(reflectionLevels - 1));
+	iblStep = IBLStep::Capture;
+	iblLevel = 0;
+
+	// Without a previous environment to show in the meantime, spreading the work out gains nothing
+	if (!iblReady)
+		while (iblStep != IBLStep::Idle)
+			step_ibl();
+}
 
-		int levelSize = reflectionSize * pow(0.5, level);
+std::string Render::ibl_step_name() {
+	switch (iblStep) {
+	case IBLStep::Idle:
+		return "";
+	case IBLStep::Capture:
+		return "IBL capture";
+	case IBLStep::Irradiance:
+		return "IBL irradiance";
+	case IBLStep::Reflection:
+		return "IBL reflection " + std::to_string(iblLevel);
+	}
+	return "";
+}
+
+void Render::step_ibl() {
+	int back = 1 - iblFront;
+	gpuTimers.begin(ibl_step_name());
+
+	switch (iblStep) {
+	case IBLStep::Idle:
+		break;
+
+	case IBLStep::Capture:
+		render_cubemap(Shader::Type::Skybox, RenderOrder::Shader, skyboxCubemap, skyboxSize);
+		glGenerateTextureMipmap(skyboxCubemap);
+		iblStep = IBLStep::Irradiance;
+		break;
+
+	case IBLStep::Irradiance: {
+		static GLuint shProjectShader = load_spirv_program({{Shaders::sh_project_comp, GL_COMPUTE_SHADER}});
+		static GLuint shReduceShader = load_spirv_program({{Shaders::sh_reduce_comp, GL_COMPUTE_SHADER}});
+		glBindTextures(1, 1, &skyboxCubemap);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, irradiancePartials);
+
+		glUseProgram(shProjectShader);
+		glUniform1f(0, std::log2(static_cast<float>(skyboxSize) / static_cast<float>(irradianceSampleSize)));
+		glDispatchCompute(irradianceSampleSize / 8, irradianceSampleSize / 8, 6);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, irradianceSH[back]);
+		glUseProgram(shReduceShader);
+		glDispatchCompute(1, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, irradianceSH[iblFront]);
+
+		iblStep = IBLStep::Reflection;
+		iblLevel = 0;
+		break;
+	}
+
+	case IBLStep::Reflection: {
+		GLuint framebuffer;
+		glCreateFramebuffers(1, &framebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+
+		auto& skyboxMesh = meshes_get(surfaces_get(skybox).mesh);
+		glBindVertexArray(meshPool.vao());
+		bind_cube_cameras();
+
+		static GLuint reflectionShader = load_layered_program(Shaders::reflection_frag);
+		glUseProgram(reflectionShader);
+		glBindTextures(1, 1, &skyboxCubemap);
+		glUniform1f(2, static_cast<float>(skyboxSize));
+
+		glUniform1f(1, static_cast<float>(iblLevel) / static_cast<float>(reflectionLevels - 1));
+		// Filtered importance sampling converges quickly; rougher lobes get more samples, the mirror level just copies
+		glUniform1ui(3, iblLevel == 0 ? 1 : static_cast<GLuint>(reflectionBaseSamples) << (iblLevel - 1));
+
+		int levelSize = reflectionSize >> iblLevel;
+		glUniform1f(4, static_cast<float>(levelSize));
 		glViewport(0, 0, levelSize, levelSize);
-		for (int i = 0; i < 6; i++) {
-			glNamedFramebufferTextureLayer(framebuffer, GL_COLOR_ATTACHMENT0, reflection, level, i);
+		glNamedFramebufferTexture(framebuffer, GL_COLOR_ATTACHMENT0, reflection[back], iblLevel);
 
-			Camera cam = {
-				.proj = infinitePerspective(glm::radians(90.0f), 1.0f, 0.1f),
-				.view = captureViews[i],
-				.camPos = vec3(0.0f)};
-			glNamedBufferSubData(cameraBuffer, 0, sizeof(Camera), &cam);
+		glClear(GL_COLOR_BUFFER_BIT);
+		draw_mesh(skyboxMesh, 6, 0);
 
-			glClear(GL_COLOR_BUFFER_BIT);
-			glDrawElements(GL_TRIANGLES, meshes_get(surfaces_get(skybox).mesh).count, GL_UNSIGNED_INT, 0);
-		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glDeleteFramebuffers(1, &framebuffer);
+
+		iblLevel++;
+		break;
+	}
 	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glDeleteFramebuffers(1, &framebuffer);
+	gpuTimers.end();
+
+	if (iblStep == IBLStep::Reflection && iblLevel == reflectionLevels) {
+		swap_ibl();
+		if (iblKey)
+			store_ibl(iblFront, iblKey.value());
+	}
+}
+
+void Render::swap_ibl() {
+	iblFront = 1 - iblFront;
+	iblReady = true;
+	iblStep = IBLStep::Idle;
+
+	scene_textures = {reflection[iblFront], reflectionBRDF};
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, irradianceSH[iblFront]);
 
-	// set_skybox_rect_texture(reflectionBRDF, false);
+	// Only needed while prefiltering
+	glDeleteTextures(1, &skyboxCubemap);
+	skyboxCubemap = 0;
 }
 
-void Render::set_skybox_rect_texture(TextureHandle texture, bool update) {
-	static ShaderHandle skyboxShader = shaders_insert(Shader{
-		load_spirv_program({{Shaders::skybox_vert, GL_VERTEX_SHADER}, {Shaders::rect_skybox_frag, GL_FRAGMENT_SHADER}}),
-		Shader::Type::Opaque | Shader::Type::Skybox});
+void Render::run() {
+	// At least one step per frame, then more while the steps' last measured times fit in the budget
+	double spent = 0;
+	while (iblStep != IBLStep::Idle) {
+		double estimate = gpuTimers.last(ibl_step_name()).value_or(iblBudget);
+		if (spent > 0 && spent + estimate > iblBudget)
+			break;
+		spent += estimate;
+		step_ibl();
+	}
+
+	Core::run();
+}
+
+void Render::set_skybox_rect_texture(TextureHandle texture, bool update, std::optional<uint64_t> source_hash) {
 	static ShaderHandle skyboxDepthShader = shaders_insert(Shader{
 		load_spirv_program({{Shaders::skybox_vert, GL_VERTEX_SHADER}, {Shaders::depth_frag, GL_FRAGMENT_SHADER}}),
 		Shader::Type::Depth});
-	static MaterialHandle skyboxMaterial = materials_insert(Material{
-		{{.shader = skyboxShader, .uniform = 0, .textures = {texture}},
-		 {.shader = skyboxDepthShader, .uniform = 0, .textures = {}}}});
-	materials_get(skyboxMaterial).shader_passes[0].textures[0] = texture;
-	set_skybox_material(skyboxMaterial, update);
+	static MaterialHandle skyboxMaterial = [&] {
+		auto passes = skybox_shader_passes(Shaders::rect_skybox_frag);
+		passes.push_back({.shader = skyboxDepthShader});
+		return materials_insert(Material{passes});
+	}();
+	auto& passes = materials_get(skyboxMaterial).shader_passes;
+	passes[0].textures = passes[1].textures = texture_set({texture});
+	std::optional<uint64_t> key;
+	if (source_hash)
+		key = hash_vector(Shaders::rect_skybox_frag, source_hash.value());
+	// The equirect's width spans four cube faces
+	GLint width;
+	glGetTextureLevelParameteriv(texture, 0, GL_TEXTURE_WIDTH, &width);
+	set_skybox_material(skyboxMaterial, update, key, width / 4);
 }
 
-void Render::set_skybox_cube_texture(TextureHandle texture, bool update) {
-	static ShaderHandle skyboxShader = shaders_insert(Shader{
-		load_spirv_program({{Shaders::skybox_vert, GL_VERTEX_SHADER}, {Shaders::cube_skybox_frag, GL_FRAGMENT_SHADER}}),
-		Shader::Type::Opaque | Shader::Type::Skybox});
+void Render::set_skybox_cube_texture(TextureHandle texture, bool update, std::optional<uint64_t> source_hash) {
 	static ShaderHandle skyboxDepthShader = shaders_insert(Shader{
 		load_spirv_program({{Shaders::skybox_vert, GL_VERTEX_SHADER}, {Shaders::depth_frag, GL_FRAGMENT_SHADER}}),
 		Shader::Type::Depth});
-	static MaterialHandle skyboxMaterial = materials_insert(Material{
-		{{.shader = skyboxShader, .uniform = 0, .textures = {texture}},
-		 {.shader = skyboxDepthShader, .uniform = 0, .textures = {}}}});
-	materials_get(skyboxMaterial).shader_passes[0].textures[0] = texture;
-	set_skybox_material(skyboxMaterial, update);
+	static MaterialHandle skyboxMaterial = [&] {
+		auto passes = skybox_shader_passes(Shaders::cube_skybox_frag);
+		passes.push_back({.shader = skyboxDepthShader});
+		return materials_insert(Material{passes});
+	}();
+	auto& passes = materials_get(skyboxMaterial).shader_passes;
+	passes[0].textures = passes[1].textures = texture_set({texture});
+	std::optional<uint64_t> key;
+	if (source_hash)
+		key = hash_vector(Shaders::cube_skybox_frag, source_hash.value());
+	GLint width;
+	glGetTextureLevelParameteriv(texture, 0, GL_TEXTURE_WIDTH, &width);
+	set_skybox_material(skyboxMaterial, update, key, width);
 }
 
 MeshHandle Render::standard_mesh_create(StandardMesh mesh) {
@@ -344,36 +653,30 @@ MeshHandle Render::standard_mesh_create(StandardMesh mesh) {
 
 	mesh.reindex();
 
-	GLuint vertex_buffer, index_buffer, vao;
-	glCreateBuffers(1, &vertex_buffer);
-	glCreateBuffers(1, &index_buffer);
-	glCreateVertexArrays(1, &vao);
-
-	glNamedBufferStorage(vertex_buffer, mesh.vertex_data.size() * sizeof(float), mesh.vertex_data.data(), 0);
-	glNamedBufferStorage(index_buffer, mesh.indices.size() * sizeof(uint32_t), mesh.indices.data(), 0);
-
-	glVertexArrayElementBuffer(vao, index_buffer);
-	glVertexArrayVertexBuffer(vao, 0, vertex_buffer, 0, mesh.stride * sizeof(float));
-	glVertexArrayVertexBuffer(vao, 15, zero_buffer, 0, 0);
-
-	uint attrib_index = 0;
-
-#define STANDARD_MESH_VERTEX_FEILD(name, size)                                                                         \
-	if (mesh.format.has_##name) {                                                                                      \
-		glEnableVertexArrayAttrib(vao, attrib_index);                                                                  \
-		glVertexArrayAttribFormat(vao, attrib_index, size, GL_FLOAT, false, mesh.offset_##name * sizeof(float));       \
-		glVertexArrayAttribBinding(vao, attrib_index, 0);                                                              \
-	} else {                                                                                                           \
-		glEnableVertexArrayAttrib(vao, attrib_index);                                                                  \
-		glVertexArrayAttribFormat(vao, attrib_index, size, GL_FLOAT, false, 0);                                        \
-		glVertexArrayAttribBinding(vao, attrib_index, 15);                                                             \
-	}                                                                                                                  \
-	attrib_index++;
-	STANDARD_MESH_VERTEX_FORMAT
-#undef STANDARD_MESH_VERTEX_FEILD
-
-	return meshes_insert(
-		Mesh{.vao = vao, .count = static_cast<int>(mesh.indices.size()), .buffers = {vertex_buffer, index_buffer}});
+	// Repack into the pool's layout, attributes it has no slot for are dropped
+	std::vector<float> vertexData(mesh.vertex_count * MeshPool::vertexFloats);
+	for (size_t i = 0; i < mesh.vertex_count; i++) {
+		float* vertex = vertexData.data() + i * MeshPool::vertexFloats;
+		size_t offset = 0;
+#define POOL_VERTEX_FIELD(name, size)                                                                                  \
+	if (mesh.format.has_##name)                                                                                        \
+		std::copy_n(&mesh.name(i).x, size, vertex + offset);                                                           \
+	offset += size;
+		POOL_VERTEX_FIELD(position, 3)
+		POOL_VERTEX_FIELD(normal, 3)
+		POOL_VERTEX_FIELD(tangent, 3)
+		POOL_VERTEX_FIELD(bitangent, 3)
+		POOL_VERTEX_FIELD(tex_coord_0, 2)
+#undef POOL_VERTEX_FIELD
+	}
+
+	AABB bounds = {.min = vec3(std::numeric_limits<float>::max()), .max = vec3(std::numeric_limits<float>::lowest())};
+	for (size_t i = 0; i < mesh.vertex_count; i++) {
+		bounds.min = min(bounds.min, mesh.position(i));
+		bounds.max = max(bounds.max, mesh.position(i));
+	}
+
+	return mesh_create(vertexData, mesh.indices, bounds);
 }
 
 } // namespace Render
\ No newline at end of file
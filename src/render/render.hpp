@@ -1,8 +1,10 @@
 #pragma once
 
+#include <array>
 #include <optional>
 
 #include "core.hpp"
+#include "disk_cache.hpp"
 #include "standard_mesh.hpp"
 
 namespace Render {
@@ -23,40 +25,112 @@ struct MaterialPBR {
 	bool doubleSided = false;
 };
 
+struct SkyboxStorage {
+	size_t budget = 256 << 20; // Bytes of VRAM the skybox cube and its mips may take
+	bool compact = true;       // R11F_G11F_B10F rather than RGB16F
+};
+
 class Render : public Core {
-	const int skyboxSize = 4096;
-	const int irradianceSize = 64;
+	// The skybox cube is only an input to IBL prefiltering and lives just as long, the visible sky samples the source
+	// texture directly. It is sized for the source and the display, within skyboxStorage.budget
+	int skyboxSize = 0;
+	GLenum skyboxFormat = 0;
+	int skyboxSourceSize = 0;
+	// Face size the skybox mip chain is sampled at when projecting irradiance to spherical harmonics
+	const int irradianceSampleSize = 64;
 	const int reflectionSize = 512;
 	const int reflectionLevels = 5;
+	// Samples for the first rough level, doubling with each one after it; the mirror level just copies
+	const int reflectionBaseSamples = 32;
 	const int reflectionBRDFSize = 256;
 
 	SurfaceHandle skybox;
-	TextureHandle skyboxCubemap;
-	TextureHandle irradiance;
-	TextureHandle reflection;
+	TextureHandle skyboxCubemap = 0;
+	GLuint irradiancePartials;
 	TextureHandle reflectionBRDF;
+	// Double buffered, the front pair is bound for rendering while the back pair is regenerated
+	std::array<GLuint, 2> irradianceSH;
+	std::array<TextureHandle, 2> reflection;
+	int iblFront = 0;
+
+	SkyboxStorage skyboxStorage;
 
-	GLuint zero_buffer;
+	struct SprivStage {
+		const std::vector<uint32_t>& data;
+		GLenum shaderType;
+		std::string entryPoint = "main";
+		// Pairs of specialization constant id and value
+		std::vector<std::pair<GLuint, GLuint>> constants = {};
+	};
+	ProgramCache programCache;
+	GLuint load_spirv_program(const std::vector<SprivStage> stages);
 
+	// Cube faces are rendered in one draw, each instance routed to its face's layer
+	bool layerFromVertex = false;
+	void bind_cube_cameras();
+	GLuint load_layered_program(const std::vector<uint32_t>& fragment);
+	// A display pass for the visible skybox followed by the pass that captures it into skyboxCubemap
+	std::vector<Material::ShaderPass> skybox_shader_passes(const std::vector<uint32_t>& fragment);
 	void render_cubemap(Shader::Type type, RenderOrder order, GLuint cubemap, GLsizei width);
+	void size_skybox_cubemap();
+
+	// Identifies the skybox source, so its prefiltered IBL results can be reused from disk
+	std::optional<uint64_t> skyboxKey;
+	uint64_t ibl_key(uint64_t source);
+	bool load_ibl(int index, uint64_t key);
+	void store_ibl(int index, uint64_t key);
+
+	// IBL regeneration is split into steps, run a few per frame under iblBudget milliseconds of GPU time
+	enum class IBLStep { Idle, Capture, Irradiance, Reflection };
+	IBLStep iblStep = IBLStep::Idle;
+	int iblLevel = 0;
+	std::optional<uint64_t> iblKey;
+	bool iblReady = false;
+	double iblBudget = 2.0;
+	std::string ibl_step_name();
+	void step_ibl();
+	void swap_ibl();
+
+	struct PBR;
+	PBR pbr_params(const MaterialPBR&);
+	std::vector<Material::ShaderPass> pbr_shader_passes(const MaterialPBR&);
+
+	// PBR programs specialized on which textures a material has, compiled on first use
+	enum class PBRVariant { Opaque, Transparent, CutoffDepth };
+	std::unordered_map<uint32_t, ShaderHandle> pbr_shaders;
+	ShaderHandle pbr_shader(PBRVariant variant, uint32_t features);
 
   public:
-	Render(void (*glGetProcAddr(const char*))());
+	Render(void (*glGetProcAddr(const char*))(), JobSystem& jobs);
 	Render(const Render&) = delete;
 
 	MaterialHandle create_pbr_material(MaterialPBR);
+	void update_pbr_material(MaterialHandle&, MaterialPBR);
 
-	void set_skybox_material(MaterialHandle material, bool update = true) {
+	// cache_key must change whenever the skybox would render differently, e.g. a hash of the source file
+	void set_skybox_material(
+		MaterialHandle material, bool update = true, std::optional<uint64_t> cache_key = {}, int source_size = 0) {
 		surface_set_material(skybox, material);
+		skyboxKey = cache_key;
+		skyboxSourceSize = source_size;
 		if (update)
 			update_skybox();
 	}
-	void set_skybox_rect_texture(TextureHandle, bool update = true);
-	void set_skybox_cube_texture(TextureHandle, bool update = true);
+	// Applies from the next update_skybox
+	void set_skybox_storage(SkyboxStorage storage) { skyboxStorage = storage; }
+
+	void set_skybox_rect_texture(TextureHandle, bool update = true, std::optional<uint64_t> source_hash = {});
+	void set_skybox_cube_texture(TextureHandle, bool update = true, std::optional<uint64_t> source_hash = {});
 
+	// Starts regenerating the IBL from the skybox, the previous environment stays in use until it completes
 	void update_skybox();
+	void set_ibl_budget(double ms) { iblBudget = ms; }
+
+	void run();
 
 	MeshHandle standard_mesh_create(StandardMesh mesh);
+
+	const ProgramCache::Stats& program_cache_stats() { return programCache.stats; }
 };
 
 } // namespace Render
\ No newline at end of file
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "core.hpp"
+
+namespace Render {
+
+// What the simulation changed in the scene over one frame, for the thread owning the renderer to apply before it
+// draws. Changes are kept by handle id in the order they were made, and the setters match Core's. The handles must
+// still be alive when it's applied, so objects are created and deleted on the renderer's thread. Each section is a
+// type of its own, for systems to declare which ones they write
+struct SceneSnapshot {
+	struct Camera {
+		std::optional<mat4> pos;
+
+		void camera_set_pos(mat4 camera) { pos = camera; }
+	};
+	struct Lights {
+		std::vector<std::pair<size_t, vec3>> points, spots;
+		// Applied after the moves
+		std::vector<size_t> deletedPoints, deletedSpots;
+
+		void point_light_set_pos(const PointLightHandle& light, vec3 pos) { points.emplace_back(light.id(), pos); }
+		void spot_light_set_pos(const SpotLightHandle& light, vec3 pos) { spots.emplace_back(light.id(), pos); }
+		void point_light_delete(PointLightHandle light) { deletedPoints.push_back(light.id()); }
+		void spot_light_delete(SpotLightHandle light) { deletedSpots.push_back(light.id()); }
+	};
+	struct Transforms {
+		std::vector<std::pair<size_t, mat4>> nodeLocals, surfaces;
+
+		void transform_node_set_local(const TransformNodeHandle& node, mat4 local) {
+			nodeLocals.emplace_back(node.id(), local);
+		}
+		void surface_set_transform(const SurfaceHandle& surface, mat4 transform) {
+			surfaces.emplace_back(surface.id(), transform);
+		}
+	};
+	Camera camera;
+	Lights lights;
+	Transforms transforms;
+
+	// Keeps the lists' storage for the next frame
+	void clear() {
+		camera.pos.reset();
+		lights.points.clear();
+		lights.spots.clear();
+		lights.deletedPoints.clear();
+		lights.deletedSpots.clear();
+		transforms.nodeLocals.clear();
+		transforms.surfaces.clear();
+	}
+};
+
+} // namespace Render
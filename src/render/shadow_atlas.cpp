@@ -0,0 +1,62 @@
+#include "shadow_atlas.hpp"
+
+#include <algorithm>
+#include <bit>
+
+namespace Render {
+
+int ShadowAtlas::level(int size) const {
+	return std::countr_zero(static_cast<unsigned>(atlasSize)) - std::countr_zero(static_cast<unsigned>(size));
+}
+
+void ShadowAtlas::reset(int size, int minTile) {
+	atlasSize = size;
+	freeBlocks.assign(level(std::min(minTile, size)) + 1, {});
+	freeBlocks[0].push_back({0, 0, size});
+}
+
+std::optional<ShadowAtlas::Tile> ShadowAtlas::allocate(int size) {
+	if (atlasSize == 0 || size > atlasSize)
+		return {};
+	int target = std::min<int>(level(std::bit_ceil(static_cast<unsigned>(size))), freeBlocks.size() - 1);
+
+	// Take the smallest free block that fits, then split it down, freeing the other three quadrants each time
+	int from = target;
+	while (from >= 0 && freeBlocks[from].empty())
+		from--;
+	if (from < 0)
+		return {};
+
+	Tile tile = freeBlocks[from].back();
+	freeBlocks[from].pop_back();
+	for (int l = from + 1; l <= target; l++) {
+		tile.size /= 2;
+		freeBlocks[l].push_back({tile.x + tile.size, tile.y, tile.size});
+		freeBlocks[l].push_back({tile.x, tile.y + tile.size, tile.size});
+		freeBlocks[l].push_back({tile.x + tile.size, tile.y + tile.size, tile.size});
+	}
+	return tile;
+}
+
+void ShadowAtlas::release(Tile tile) {
+	for (int l = level(tile.size); l > 0; l--) {
+		// Merge back into the parent block while all four quadrants are free
+		int parentSize = tile.size * 2;
+		Tile parent = {tile.x - tile.x % parentSize, tile.y - tile.y % parentSize, parentSize};
+		auto& blocks = freeBlocks[l];
+		auto siblings = std::count_if(blocks.begin(), blocks.end(), [&](const Tile& block) {
+			return block.x - block.x % parentSize == parent.x && block.y - block.y % parentSize == parent.y;
+		});
+		if (siblings < 3) {
+			blocks.push_back(tile);
+			return;
+		}
+		std::erase_if(blocks, [&](const Tile& block) {
+			return block.x - block.x % parentSize == parent.x && block.y - block.y % parentSize == parent.y;
+		});
+		tile = parent;
+	}
+	freeBlocks[0].push_back(tile);
+}
+
+} // namespace Render
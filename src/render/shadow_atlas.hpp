@@ -0,0 +1,33 @@
+#pragma once
+
+#include <optional>
+#include <vector>
+
+namespace Render {
+
+// Buddy allocator for square, power of two tiles of a square shadow atlas.
+// Level 0 is the whole atlas, each level below splits its blocks into four quadrants.
+class ShadowAtlas {
+  public:
+	struct Tile {
+		int x, y, size;
+		bool operator==(const Tile&) const = default;
+	};
+
+  private:
+	int atlasSize = 0;
+	std::vector<std::vector<Tile>> freeBlocks;
+
+	int level(int size) const;
+
+  public:
+	// Drops every allocation; minTile bounds how far blocks are split
+	void reset(int size, int minTile);
+	int size() const { return atlasSize; }
+
+	// size is rounded up to a power of two, at least minTile
+	std::optional<Tile> allocate(int size);
+	void release(Tile tile);
+};
+
+} // namespace Render
@@ -0,0 +1,118 @@
+#include "transform_hierarchy.hpp"
+
+namespace Render {
+
+void TransformHierarchy::insert(size_t handle, size_t parent, glm::mat4 local) {
+	if (handle >= slots.size())
+		slots.resize(handle + 1, none);
+	size_t parentSlot = parent == none ? none : slots[parent];
+	slots[handle] = handles.size();
+	parents.push_back(parentSlot);
+	locals.push_back(local);
+	worlds.push_back(parentSlot == none ? local : worlds[parentSlot] * local);
+	dirty.push_back(1);
+	handles.push_back(handle);
+	anyDirty = true;
+	unsorted = true;
+}
+
+void TransformHierarchy::remove(size_t handle) {
+	if (!contains(handle))
+		return;
+	size_t slot = slots[handle];
+	slots[handle] = none;
+	handles[slot] = none;
+	locals[slot] = glm::mat4(1.0f);
+	dirty[slot] = 1;
+	removed++;
+	anyDirty = true;
+	unsorted = true;
+}
+
+bool TransformHierarchy::set_parent(size_t handle, size_t parent) {
+	size_t slot = slots[handle];
+	size_t parentSlot = parent == none ? none : slots[parent];
+	for (size_t p = parentSlot; p != none; p = parents[p])
+		if (p == slot)
+			return false;
+	parents[slot] = parentSlot;
+	dirty[slot] = 1;
+	anyDirty = true;
+	unsorted = true;
+	return true;
+}
+
+void TransformHierarchy::sort() {
+	size_t count = handles.size();
+
+	// Children of removed nodes skip up to the nearest live ancestor, and are recomputed against it
+	for (size_t i = 0; i < count; i++) {
+		if (handles[i] == none)
+			continue;
+		size_t parent = parents[i];
+		if (parent == none || handles[parent] != none)
+			continue;
+		while (parent != none && handles[parent] == none)
+			parent = parents[parent];
+		parents[i] = parent;
+		dirty[i] = 1;
+	}
+
+	// Children of each slot, contiguous in firstChild[slot] to firstChild[slot + 1]
+	std::vector<size_t> firstChild(count + 1, 0), children(count);
+	for (size_t i = 0; i < count; i++)
+		if (handles[i] != none && parents[i] != none)
+			firstChild[parents[i] + 1]++;
+	for (size_t i = 0; i < count; i++)
+		firstChild[i + 1] += firstChild[i];
+	std::vector<size_t> cursor(firstChild.begin(), firstChild.end() - 1);
+	for (size_t i = 0; i < count; i++)
+		if (handles[i] != none && parents[i] != none)
+			children[cursor[parents[i]]++] = i;
+
+	std::vector<size_t> order;
+	order.reserve(count - removed);
+	for (size_t i = 0; i < count; i++)
+		if (handles[i] != none && parents[i] == none)
+			order.push_back(i);
+	for (size_t head = 0; head < order.size(); head++)
+		for (size_t c = firstChild[order[head]]; c < firstChild[order[head] + 1]; c++)
+			order.push_back(children[c]);
+
+	std::vector<size_t> newSlots(count, none);
+	for (size_t i = 0; i < order.size(); i++)
+		newSlots[order[i]] = i;
+
+	// Breadth first order puts each depth after the one above it
+	levelStarts.clear();
+	std::vector<size_t> depths(order.size());
+	for (size_t i = 0; i < order.size(); i++) {
+		size_t parent = parents[order[i]];
+		depths[i] = parent == none ? 0 : depths[newSlots[parent]] + 1;
+		if (i == 0 || depths[i] != depths[i - 1])
+			levelStarts.push_back(i);
+	}
+	levelStarts.push_back(order.size());
+
+	std::vector<size_t> newParents(order.size()), newHandles(order.size());
+	std::vector<glm::mat4> newLocals(order.size()), newWorlds(order.size());
+	std::vector<uint8_t> newDirty(order.size());
+	for (size_t i = 0; i < order.size(); i++) {
+		size_t old = order[i];
+		newParents[i] = parents[old] == none ? none : newSlots[parents[old]];
+		newLocals[i] = locals[old];
+		newWorlds[i] = worlds[old];
+		newDirty[i] = dirty[old];
+		newHandles[i] = handles[old];
+		slots[handles[old]] = i;
+	}
+	parents = std::move(newParents);
+	locals = std::move(newLocals);
+	worlds = std::move(newWorlds);
+	dirty = std::move(newDirty);
+	handles = std::move(newHandles);
+	removed = 0;
+	unsorted = false;
+}
+
+} // namespace Render
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <limits>
+#include <vector>
+
+#include "job_system.hpp"
+
+namespace Render {
+
+// Local and world matrices of a tree of nodes, keyed by handle. The nodes are kept in structure of arrays order,
+// breadth first so every parent comes before its children, which lets update() recompute the world matrices of the
+// dirty subtrees in a linear sweep, level by level. Changes to the tree's shape only mark it unsorted, the next
+// update() sorts it.
+class TransformHierarchy {
+  public:
+	static constexpr size_t none = std::numeric_limits<size_t>::max();
+
+  private:
+	// By slot. Parents are slots too, none for roots. Removed nodes stay behind as identity nodes with no handle
+	// until the next sort, so their children keep the right world matrices
+	std::vector<size_t> parents;
+	std::vector<glm::mat4> locals;
+	std::vector<glm::mat4> worlds;
+	std::vector<uint8_t> dirty;
+	std::vector<size_t> handles;
+	// Slot of each handle, none for handles not in the hierarchy
+	std::vector<size_t> slots;
+	// First slot of each depth, then the end. Only kept up to date by sort()
+	std::vector<size_t> levelStarts;
+	bool anyDirty = false;
+	bool unsorted = false;
+	size_t removed = 0;
+
+	void sort();
+
+  public:
+	void insert(size_t handle, size_t parent, glm::mat4 local);
+	// The node's children move to its parent, keeping their local matrices
+	void remove(size_t handle);
+	bool contains(size_t handle) const { return handle < slots.size() && slots[handle] != none; }
+	size_t size() const { return handles.size() - removed; }
+
+	// Returns false without changing anything when parent is the node or one of its descendants
+	bool set_parent(size_t handle, size_t parent);
+	size_t parent(size_t handle) const {
+		size_t p = parents[slots[handle]];
+		while (p != none && handles[p] == none)
+			p = parents[p];
+		return p == none ? none : handles[p];
+	}
+
+	void set_local(size_t handle, const glm::mat4& local) {
+		size_t slot = slots[handle];
+		locals[slot] = local;
+		dirty[slot] = 1;
+		anyDirty = true;
+	}
+	const glm::mat4& local(size_t handle) const { return locals[slots[handle]]; }
+	// As of the last update()
+	const glm::mat4& world(size_t handle) const { return worlds[slots[handle]]; }
+
+	// Recomputes the world matrices of dirty nodes and everything below them, then calls f(handle, world) for each on
+	// this thread. Returns how many were recomputed
+	template <class F> size_t update(JobSystem& jobs, F&& f) {
+		if (unsorted)
+			sort();
+		if (!anyDirty)
+			return 0;
+
+		// Every parent is in an earlier level, so the nodes of a level can be swept in parallel
+		for (size_t level = 0; level + 1 < levelStarts.size(); level++) {
+			size_t first = levelStarts[level];
+			jobs.parallel_for(levelStarts[level + 1] - first, 4096, [&](size_t begin, size_t end) {
+				for (size_t i = first + begin; i < first + end; i++) {
+					size_t parent = parents[i];
+					if (parent != none && dirty[parent])
+						dirty[i] = 1;
+					if (dirty[i])
+						worlds[i] = parent == none ? locals[i] : worlds[parent] * locals[i];
+				}
+			});
+		}
+
+		size_t count = 0;
+		for (size_t i = 0; i < handles.size(); i++)
+			if (dirty[i]) {
+				f(handles[i], worlds[i]);
+				dirty[i] = 0;
+				count++;
+			}
+		anyDirty = false;
+		return count;
+	}
+};
+
+} // namespace Render
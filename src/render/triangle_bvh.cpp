@@ -0,0 +1,265 @@
+#include "triangle_bvh.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TRIANGLE_BVH_SSE
+#endif
+
+namespace Render {
+
+static const size_t packetSize = 4;
+
+static float surface_area(glm::vec3 min, glm::vec3 max) {
+	glm::vec3 d = max - min;
+	return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+TriangleBVH::TriangleBVH(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices) {
+	std::vector<BuildRef> refs(indices.size() / 3);
+	for (size_t i = 0; i < refs.size(); i++) {
+		glm::vec3 a = positions[indices[i * 3]], b = positions[indices[i * 3 + 1]], c = positions[indices[i * 3 + 2]];
+		glm::vec3 min = glm::min(glm::min(a, b), c), max = glm::max(glm::max(a, b), c);
+		refs[i] = {static_cast<uint32_t>(i), min, max, (min + max) * 0.5f};
+	}
+	if (refs.empty())
+		return;
+
+	nodes.reserve(refs.size());
+	packets.reserve(refs.size() / packetSize + 1);
+	nodes.emplace_back();
+	build(refs, 0, refs.size(), 0);
+
+	// Packets only need the triangles' corners, filled in now the order is known
+	for (auto& packet : packets)
+		for (size_t lane = 0; lane < packetSize; lane++) {
+			uint32_t triangle = packet.triangle[lane];
+			if (triangle == std::numeric_limits<uint32_t>::max())
+				continue;
+			glm::vec3 v0 = positions[indices[triangle * 3]];
+			glm::vec3 e1 = positions[indices[triangle * 3 + 1]] - v0;
+			glm::vec3 e2 = positions[indices[triangle * 3 + 2]] - v0;
+			for (int axis = 0; axis < 3; axis++) {
+				packet.v0[axis][lane] = v0[axis];
+				packet.e1[axis][lane] = e1[axis];
+				packet.e2[axis][lane] = e2[axis];
+			}
+		}
+}
+
+void TriangleBVH::build(std::vector<BuildRef>& refs, size_t begin, size_t end, uint32_t node) {
+	glm::vec3 min(std::numeric_limits<float>::max()), max(std::numeric_limits<float>::lowest());
+	glm::vec3 centroidMin = min, centroidMax = max;
+	for (size_t i = begin; i < end; i++) {
+		min = glm::min(min, refs[i].min);
+		max = glm::max(max, refs[i].max);
+		centroidMin = glm::min(centroidMin, refs[i].centroid);
+		centroidMax = glm::max(centroidMax, refs[i].centroid);
+	}
+	nodes[node].min = min;
+	nodes[node].max = max;
+
+	if (end - begin <= packetSize) {
+		Packet packet = {};
+		for (size_t lane = 0; lane < packetSize; lane++)
+			packet.triangle[lane] =
+				begin + lane < end ? refs[begin + lane].triangle : std::numeric_limits<uint32_t>::max();
+		nodes[node].index = static_cast<uint32_t>(packets.size());
+		nodes[node].isLeaf = 1;
+		packets.push_back(packet);
+		return;
+	}
+
+	glm::vec3 extent = centroidMax - centroidMin;
+	int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+	// Binned SAH along the longest axis, or a median split when the bins can't separate the centroids
+	size_t mid = begin;
+	if (extent[axis] > 0) {
+		const int binCount = 16;
+		struct Bin {
+			glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+			glm::vec3 max = glm::vec3(std::numeric_limits<float>::lowest());
+			size_t count = 0;
+		};
+		std::array<Bin, binCount> bins;
+		float scale = binCount / extent[axis];
+		auto bin_of = [&](const BuildRef& ref) {
+			return std::min(static_cast<int>((ref.centroid[axis] - centroidMin[axis]) * scale), binCount - 1);
+		};
+		for (size_t i = begin; i < end; i++) {
+			Bin& bin = bins[bin_of(refs[i])];
+			bin.min = glm::min(bin.min, refs[i].min);
+			bin.max = glm::max(bin.max, refs[i].max);
+			bin.count++;
+		}
+
+		std::array<float, binCount> leftCost;
+		Bin left;
+		for (int b = 0; b < binCount - 1; b++) {
+			left.min = glm::min(left.min, bins[b].min);
+			left.max = glm::max(left.max, bins[b].max);
+			left.count += bins[b].count;
+			leftCost[b] = left.count ? surface_area(left.min, left.max) * left.count : 0;
+		}
+		Bin right;
+		float bestCost = std::numeric_limits<float>::infinity();
+		int bestSplit = 0;
+		for (int b = binCount - 1; b > 0; b--) {
+			right.min = glm::min(right.min, bins[b].min);
+			right.max = glm::max(right.max, bins[b].max);
+			right.count += bins[b].count;
+			float cost = leftCost[b - 1] + (right.count ? surface_area(right.min, right.max) * right.count : 0);
+			if (right.count < end - begin && right.count > 0 && cost < bestCost) {
+				bestCost = cost;
+				bestSplit = b;
+			}
+		}
+		if (bestSplit > 0)
+			mid = std::partition(
+					  refs.begin() + begin, refs.begin() + end,
+					  [&](const BuildRef& ref) { return bin_of(ref) < bestSplit; }) -
+				refs.begin();
+	}
+	if (mid == begin) {
+		mid = begin + (end - begin) / 2;
+		std::nth_element(
+			refs.begin() + begin, refs.begin() + mid, refs.begin() + end,
+			[&](const BuildRef& a, const BuildRef& b) { return a.centroid[axis] < b.centroid[axis]; });
+	}
+
+	uint32_t left = static_cast<uint32_t>(nodes.size());
+	nodes.resize(nodes.size() + 2);
+	nodes[node].index = left;
+	nodes[node].isLeaf = 0;
+	build(refs, begin, mid, left);
+	build(refs, mid, end, left + 1);
+}
+
+std::optional<TriangleBVH::Hit> TriangleBVH::intersect(glm::vec3 origin, glm::vec3 dir, float tMax) const {
+	if (nodes.empty())
+		return {};
+
+	glm::vec3 invDir = 1.0f / dir;
+	auto enter = [&](const Node& node) {
+		const float miss = std::numeric_limits<float>::infinity();
+		float tEnter = 0, tLeave = tMax;
+		for (int axis = 0; axis < 3; axis++) {
+			// Same as SurfaceBVH::ray_enter for an axis the ray doesn't move along
+			if (std::isinf(invDir[axis])) {
+				if (origin[axis] < node.min[axis] || origin[axis] > node.max[axis])
+					return miss;
+				continue;
+			}
+			float t0 = (node.min[axis] - origin[axis]) * invDir[axis];
+			float t1 = (node.max[axis] - origin[axis]) * invDir[axis];
+			tEnter = glm::max(tEnter, glm::min(t0, t1));
+			tLeave = glm::min(tLeave, glm::max(t0, t1));
+		}
+		return tEnter <= tLeave ? tEnter : miss;
+	};
+
+	std::optional<Hit> hit;
+	std::vector<uint32_t> stack;
+	stack.reserve(64);
+	if (enter(nodes[0]) <= tMax)
+		stack.push_back(0);
+	while (!stack.empty()) {
+		const Node& node = nodes[stack.back()];
+		stack.pop_back();
+		if (node.isLeaf) {
+			const Packet& packet = packets[node.index];
+#ifdef TRIANGLE_BVH_SSE
+			// Möller-Trumbore on the four triangles at once
+			struct Vec3x4 {
+				__m128 x, y, z;
+			};
+			auto load = [](const float (&v)[3][4]) {
+				return Vec3x4{_mm_loadu_ps(v[0]), _mm_loadu_ps(v[1]), _mm_loadu_ps(v[2])};
+			};
+			auto cross = [](const Vec3x4& a, const Vec3x4& b) {
+				return Vec3x4{
+					_mm_sub_ps(_mm_mul_ps(a.y, b.z), _mm_mul_ps(a.z, b.y)),
+					_mm_sub_ps(_mm_mul_ps(a.z, b.x), _mm_mul_ps(a.x, b.z)),
+					_mm_sub_ps(_mm_mul_ps(a.x, b.y), _mm_mul_ps(a.y, b.x))};
+			};
+			auto dot = [](const Vec3x4& a, const Vec3x4& b) {
+				return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a.x, b.x), _mm_mul_ps(a.y, b.y)), _mm_mul_ps(a.z, b.z));
+			};
+			Vec3x4 d = {_mm_set1_ps(dir.x), _mm_set1_ps(dir.y), _mm_set1_ps(dir.z)};
+			Vec3x4 v0 = load(packet.v0), e1 = load(packet.e1), e2 = load(packet.e2);
+			Vec3x4 s = {
+				_mm_sub_ps(_mm_set1_ps(origin.x), v0.x), _mm_sub_ps(_mm_set1_ps(origin.y), v0.y),
+				_mm_sub_ps(_mm_set1_ps(origin.z), v0.z)};
+
+			Vec3x4 p = cross(d, e2);
+			__m128 det = dot(e1, p);
+			// Unused lanes and rays parallel to a triangle divide by zero, their NaNs and infinities fail below
+			__m128 invDet = _mm_div_ps(_mm_set1_ps(1), det);
+			__m128 u = _mm_mul_ps(dot(s, p), invDet);
+			Vec3x4 q = cross(s, e1);
+			__m128 v = _mm_mul_ps(dot(d, q), invDet);
+			__m128 t = _mm_mul_ps(dot(e2, q), invDet);
+
+			__m128 zero = _mm_setzero_ps();
+			__m128 inside = _mm_and_ps(
+				_mm_and_ps(_mm_cmpneq_ps(det, zero), _mm_cmpge_ps(u, zero)),
+				_mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1))));
+			inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmpgt_ps(t, zero), _mm_cmplt_ps(t, _mm_set1_ps(tMax))));
+			int mask = _mm_movemask_ps(inside);
+			if (mask) {
+				alignas(16) float ts[4], us[4], vs[4];
+				_mm_store_ps(ts, t);
+				_mm_store_ps(us, u);
+				_mm_store_ps(vs, v);
+				for (size_t lane = 0; lane < packetSize; lane++)
+					if ((mask >> lane) & 1 && ts[lane] < tMax) {
+						tMax = ts[lane];
+						hit = Hit{packet.triangle[lane], ts[lane], {us[lane], vs[lane]}};
+					}
+			}
+#else
+			// Möller-Trumbore one lane at a time
+			for (size_t lane = 0; lane < packetSize; lane++) {
+				glm::vec3 v0 = {packet.v0[0][lane], packet.v0[1][lane], packet.v0[2][lane]};
+				glm::vec3 e1 = {packet.e1[0][lane], packet.e1[1][lane], packet.e1[2][lane]};
+				glm::vec3 e2 = {packet.e2[0][lane], packet.e2[1][lane], packet.e2[2][lane]};
+				glm::vec3 p = glm::cross(dir, e2);
+				float det = glm::dot(e1, p);
+				if (det == 0)
+					continue;
+				float invDet = 1 / det;
+				glm::vec3 s = origin - v0;
+				float u = glm::dot(s, p) * invDet;
+				glm::vec3 q = glm::cross(s, e1);
+				float v = glm::dot(dir, q) * invDet;
+				float t = glm::dot(e2, q) * invDet;
+				if (u >= 0 && v >= 0 && u + v <= 1 && t > 0 && t < tMax) {
+					tMax = t;
+					hit = Hit{packet.triangle[lane], t, {u, v}};
+				}
+			}
+#endif
+			continue;
+		}
+
+		// Nearer child on top of the stack, children the ray misses or only reaches past the best hit are skipped
+		uint32_t left = node.index, right = node.index + 1;
+		float tLeft = enter(nodes[left]), tRight = enter(nodes[right]);
+		if (tRight < tLeft) {
+			std::swap(left, right);
+			std::swap(tLeft, tRight);
+		}
+		if (tRight <= tMax)
+			stack.push_back(right);
+		if (tLeft <= tMax)
+			stack.push_back(left);
+	}
+	return hit;
+}
+
+} // namespace Render
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <optional>
+#include <vector>
+
+namespace Render {
+
+// Static BVH over one mesh's triangles, for ray casts. Each leaf is a packet of up to four triangles that a ray is
+// tested against at once
+class TriangleBVH {
+	struct Node {
+		glm::vec3 min;
+		// Inner nodes keep their left child here, with the right one after it. Leaves keep their packet
+		uint32_t index;
+		glm::vec3 max;
+		uint32_t isLeaf;
+	};
+	// Each triangle as a corner and the two edges from it, in structure of arrays order across the packet. Unused
+	// lanes have zero edges, which no ray hits
+	struct Packet {
+		float v0[3][4];
+		float e1[3][4];
+		float e2[3][4];
+		uint32_t triangle[4];
+	};
+	std::vector<Node> nodes;
+	std::vector<Packet> packets;
+
+	struct BuildRef {
+		uint32_t triangle;
+		glm::vec3 min, max, centroid;
+	};
+	void build(std::vector<BuildRef>& refs, size_t begin, size_t end, uint32_t node);
+
+  public:
+	struct Hit {
+		uint32_t triangle;
+		float distance;
+		// Weights of the triangle's second and third vertices
+		glm::vec2 barycentrics;
+	};
+
+	TriangleBVH(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices);
+
+	// The nearest hit before tMax. dir needn't be normalised, distances are in multiples of it
+	std::optional<Hit> intersect(glm::vec3 origin, glm::vec3 dir, float tMax) const;
+};
+
+} // namespace Render
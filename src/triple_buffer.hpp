@@ -0,0 +1,47 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Hands values from one producer thread to one consumer thread without locks. The producer fills back() and
+// publishes it into the middle slot, and the consumer swaps the middle slot into front() when it holds a new value.
+// A published value is never dropped: publishing waits, or fails with try_publish(), until the last one is taken
+template <class T> class TripleBuffer {
+	std::array<T, 3> slots = {};
+	// The middle slot's index, with fresh set from when it's published until it's taken. Only the producer changes it
+	// while fresh is clear, and only the consumer while it's set
+	static constexpr uint8_t fresh = 4;
+	std::atomic<uint8_t> middle = 1;
+	uint8_t backIndex = 0, frontIndex = 2;
+
+  public:
+	// Producer side
+	T& back() { return slots[backIndex]; }
+	// Leaves back() as it was and returns false if the last value hasn't been taken yet
+	bool try_publish() {
+		if (middle.load(std::memory_order_acquire) & fresh)
+			return false;
+		backIndex = middle.exchange(backIndex | fresh, std::memory_order_acq_rel);
+		return true;
+	}
+	void publish() {
+		uint8_t current = middle.load(std::memory_order_acquire);
+		while (current & fresh) {
+			middle.wait(current, std::memory_order_acquire);
+			current = middle.load(std::memory_order_acquire);
+		}
+		try_publish();
+	}
+
+	// Consumer side
+	T& front() { return slots[frontIndex]; }
+	// Returns whether front() is a new value
+	bool acquire() {
+		if (!(middle.load(std::memory_order_acquire) & fresh))
+			return false;
+		frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & ~fresh;
+		middle.notify_one();
+		return true;
+	}
+};
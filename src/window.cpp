@@ -23,8 +23,8 @@ GLFWwindow* init() {
 	// This supposedly enables sRGB, but sRGB is enabled without it?
 	glfwWindowHint(GLFW_SRGB_CAPABLE, true);
 
-	// MSAA x8 (If I implement post-processing, I'll do AA there, so this could be removed in the future)
-	glfwWindowHint(GLFW_SAMPLES, 64);
+	// MSAA is done in Render's own framebuffer, which is resolved to the window
+	glfwWindowHint(GLFW_SAMPLES, 0);
 
 	// Debug Contexts are helpful but slow; Only enable in debug builds
 #ifndef NDEBUG
@@ -42,8 +42,8 @@ GLFWwindow* init() {
 	return window;
 }
 
-Window::Window() : Window(init()) {}
-Window::Window(GLFWwindow* window) : render(glfwGetProcAddress), window(window) {
+Window::Window(JobSystem& jobs) : Window(init(), jobs) {}
+Window::Window(GLFWwindow* window, JobSystem& jobs) : render(glfwGetProcAddress, jobs), window(window) {
 	if (glfwRawMouseMotionSupported())
 		glfwSetInputMode(window, GLFW_RAW_MOUSE_MOTION, GLFW_TRUE);
 
@@ -85,8 +85,36 @@ void Window::beginFrame() {
 	cursor.apply(xpos, ypos);
 }
 
+void Window::addInput(Input& input) {
+	auto add = [](Cursor& to, const Cursor& from) {
+		to.xpos = from.xpos;
+		to.ypos = from.ypos;
+		to.deltax += from.deltax;
+		to.deltay += from.deltay;
+	};
+	add(input.cursor, cursor);
+	add(input.scroll, scroll);
+	for (int button = 0; button <= GLFW_MOUSE_BUTTON_LAST; button++)
+		input.mouseButtons[button] = mouseButton(button);
+}
+
 void Window::endFrame() {
+	auto renderStart = std::chrono::steady_clock::now();
 	render.run();
+	renderMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - renderStart).count();
+
+	// The cursor is in screen coordinates, which needn't be framebuffer pixels
+	bool pickButton = mouseButton(GLFW_MOUSE_BUTTON_RIGHT);
+	int windowWidth, windowHeight, framebufferWidth, framebufferHeight;
+	glfwGetWindowSize(window, &windowWidth, &windowHeight);
+	glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+	if (pickButton && !pickButtonHeld && windowWidth > 0 && windowHeight > 0) {
+		auto start = std::chrono::steady_clock::now();
+		picked = render.pick(
+			cursor.xpos * framebufferWidth / windowWidth, cursor.ypos * framebufferHeight / windowHeight);
+		pickMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+	pickButtonHeld = pickButton;
 
 	// Draw the framerate counter
 	// This is replaced by Profiler if I get it working better
@@ -95,7 +123,31 @@ void Window::endFrame() {
 		"Profiler", nullptr,
 		ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_NoInputs | ImGuiWindowFlags_AlwaysAutoResize |
 			ImGuiWindowFlags_NoFocusOnAppearing | ImGuiWindowFlags_NoSavedSettings);
-	ImGui::Text("%.1f fps", ImGui::GetIO().Framerate);
+	ImGui::Text("%.1f fps, %.2f ms render CPU", ImGui::GetIO().Framerate, renderMs);
+	auto& programs = render.program_cache_stats();
+	ImGui::Text(
+		"Programs: %d cached (%.1f ms), %d linked (%.1f ms)", programs.hits, programs.load_ms, programs.misses,
+		programs.link_ms);
+	auto& stats = render.stats();
+	ImGui::Text(
+		"Shadow casters: %zu drawn, %zu culled, %zu cascades cached", stats.shadowDraws, stats.shadowCulled,
+		stats.shadowCascadesCached);
+	ImGui::Text(
+		"Surfaces: %zu visible, %zu culled%s", stats.surfacesVisible, stats.surfacesCulled,
+		stats.gpuCulling ? " (GPU driven)" : "");
+	ImGui::Text("Occluded surfaces: %zu", stats.surfacesOccluded);
+	ImGui::Text("Surface BVH: %zu nodes", stats.bvhNodes);
+	ImGui::Text("Transform nodes: %zu, %zu updated", stats.transformNodes, stats.transformsUpdated);
+	ImGui::Text("Local lights: %zu", stats.localLights);
+	ImGui::Text(
+		"Shadow atlas: %d x %d, %.1f MB", stats.shadowAtlasSize, stats.shadowAtlasSize,
+		stats.shadowAtlasBytes / 1048576.0);
+	if (picked)
+		ImGui::Text(
+			"Picked: surface %zu, triangle %u (%.2f, %.2f) at %.2f, %.3f ms", picked->surface, picked->triangle,
+			picked->barycentrics.x, picked->barycentrics.y, picked->distance, pickMs);
+	for (auto& timing : render.gpu_timings())
+		ImGui::Text("%s: %.2f ms", timing.name.c_str(), timing.ms);
 	ImGui::End();
 
 	// All imgui commands must happen before here
@@ -2,16 +2,19 @@
 
 #include "render/render.hpp"
 #include <GLFW/glfw3.h>
+#include <array>
+#include <optional>
 
 class Window {
   private:
 	Render::Render render;
 	GLFWwindow* window;
+	bool pickButtonHeld = false;
 
-	Window(GLFWwindow*);
+	Window(GLFWwindow*, JobSystem& jobs);
 
   public:
-	Window();
+	Window(JobSystem& jobs);
 	Window(const Window&) = delete;
 	~Window() {
 		glfwDestroyWindow(window);
@@ -56,6 +59,23 @@ class Window {
 	Cursor cursor;
 	Cursor scroll;
 
+	// Input for the simulation, which may run on a thread that can't call GLFW. Deltas add up until cleared, so none
+	// are lost while the simulation is behind
+	struct Input {
+		Cursor cursor = {}, scroll = {};
+		std::array<bool, GLFW_MOUSE_BUTTON_LAST + 1> mouseButtons = {};
+
+		bool mouseButton(int button) const { return mouseButtons.at(button); }
+		void clearDeltas() { cursor.deltax = cursor.deltay = scroll.deltax = scroll.deltay = 0; }
+	};
+	void addInput(Input& input);
+
+	// The surface under the cursor at the last right click, and how long finding it took
+	std::optional<Render::Render::PickResult> picked;
+	double pickMs = 0;
+	// CPU time of the last Render::run
+	double renderMs = 0;
+
 	enum CursorMode { Normal = GLFW_CURSOR_NORMAL, Hidden = GLFW_CURSOR_HIDDEN, Disabled = GLFW_CURSOR_DISABLED };
 	void setCursorMode(CursorMode mode) { glfwSetInputMode(window, GLFW_CURSOR, mode); }
 };
\ No newline at end of file